@@ -24,7 +24,9 @@ endif #module configuration u5500
 
 LOCAL_PRELINK_MODULE := false
 LOCAL_SRC_FILES := src/hdmi_service_api.c src/hdmi_service.c src/cec.c \
-	src/edid.c src/hdcp.c src/setres.c src/kevent.c src/socket.c
+	src/cmdwait.c src/dispatch.c src/dispdevice.c src/edid.c \
+	src/eventring.c src/hdcp.c src/setres.c src/kevent.c src/socket.c \
+	src/reactor.c src/sinkprofile.c src/stats.c src/sysfs.c src/timing.c
 LOCAL_CFLAGS += -DANDROID
 LOCAL_C_INCLUDES += $(LOCAL_PATH)/include
 LOCAL_SHARED_LIBRARIES := liblog
@@ -36,16 +36,36 @@ extern "C" {
  */
 #define HDMI_SERVICE_STAY_ALIVE_DURING_SUSPEND 0
 
-/* If defined, socket usage is hidden for messages from service,
- * and a callback function is used instead
+/* Functions sending a command to the service return the cmd_id of the
+ * command, > 0, or -1 if it could not be sent. The cmd_id is unique and
+ * is used in HDMI_CMDDONE, sent when the command has been handled, and
+ * in any other message answering the command.
  */
-/*#define HDMI_SERVICE_USE_CALLBACK_FN*/
 
 /* Service initialisation, threads creation
- * Input avoid_return_msg: set to 1 to avoid messages from service.
- * Return value: socket number where events will be notified.
+ * Input flags: HDMI_INIT_* flags below, or:ed together.
+ *	Set to 1 (HDMI_INIT_NO_RETURN_MSG) to avoid messages from service.
+ * Return value: socket number where events will be notified, or
+ * 0 with HDMI_INIT_CALLBACK. -1 on failure.
  */
-int hdmi_init(int avoid_return_msg);
+int hdmi_init(int flags);
+
+/* hdmi_init flags */
+#define HDMI_INIT_NO_RETURN_MSG	0x01	/* Avoid messages from service */
+#define HDMI_INIT_REACTOR	0x02	/* Serve kernel events and sockets
+					 * from one epoll thread */
+#define HDMI_INIT_DIRECT	0x04	/* Commands from this process are
+					 * added directly to the service
+					 * queue, not sent on a socket */
+#define HDMI_INIT_CALLBACK	0x08	/* As HDMI_INIT_DIRECT, and messages
+					 * from service are delivered to the
+					 * hdmi_callback_set callback from a
+					 * dispatcher thread, not a socket */
+#define HDMI_INIT_SEQPACKET	0x10	/* SOCK_SEQPACKET sockets. Each read
+					 * of the returned socket is one
+					 * message. Clients connecting to
+					 * the service must use the same
+					 * socket type */
 
 /* Service exit, threads destruction */
 int hdmi_exit(void);
@@ -56,21 +76,38 @@ int hdmi_enable(void);
 /* Disable HDMI HW */
 int hdmi_disable(void);
 
-#ifdef HDMI_SERVICE_USE_CALLBACK_FN
-/* Set callback for reception of messages from service */
+/* Set callback for reception of messages from service with
+ * HDMI_INIT_CALLBACK. May be called before hdmi_init. The callback is
+ * called from the dispatcher thread, one message at a time in the order
+ * sent, with data pointing to the message data after the header.
+ * A message is dropped if the callback falls too far behind.
+ */
 void hdmi_callback_set(void (*hdmi_cb)(int cmd, int data_size, __u8 *data));
-#endif /*HDMI_SERVICE_USE_CALLBACK_FN*/
 
 /* Change resolution. cea=0: VESA resolution, cea=1: CEA resolution */
 int hdmi_resolution_set(int cea, int vesaceanr);
 
+/* Synchronous variants of the functions above. They return when the
+ * service has handled the command, or when timeout_ms has passed.
+ * Return value: result of the command as in HDMI_CMDDONE, 0 = ok,
+ * -ETIMEDOUT if timeout_ms passed, or -1 if the command was not sent.
+ * Messages answering the command, e.g. HDMI_EDIDRESP, have been sent to
+ * the socket before the function returns.
+ * HDCP init returns when HDCP bring-up has ended.
+ */
+int hdmi_resolution_set_sync(int cea, int vesaceanr, int timeout_ms);
+int hdmi_edid_request_sync(__u8 block, int timeout_ms);
+int hdmi_hdcp_init_sync(__u16 aes_size, __u8 *aes_data, int timeout_ms);
+
 /* Release frame buffer */
 int hdmi_fb_release(void);
 
 /* Send CEC message */
 int hdmi_cec_send(__u8 initiator, __u8 destination, __u8 data_size, __u8 *data);
 
-/* Manually request EDID */
+/* Manually request EDID block, 0 to 7. Blocks after 1 are read with
+ * E-DDC segment addressing.
+ */
 int hdmi_edid_request(__u8 block);
 
 /* Initialise HDCP. AES data is required */
@@ -85,6 +122,78 @@ int hdmi_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 			__u8 vesa_cea2, __u8 nr2,
 			__u8 vesa_cea3, __u8 nr3);
 
+/* Request plug handling phase timings, answered with HDMI_STATSRESP */
+int hdmi_stats_request(void);
+
+/* Select messages sent to the socket returned by hdmi_init.
+ * Each connection to the service has its own mask, all types by default.
+ */
+int hdmi_subscribe(__u32 mask);
+
+/* Batch of commands. Commands sent from the calling thread after
+ * hdmi_batch_begin are collected, and sent together by hdmi_batch_submit
+ * in one write. The service handles them in one pass, in order, and
+ * answers only the batch with HDMI_CMDDONE, cmd = HDMI_BATCH (0xC).
+ * Each collected command still returns its own cmd_id, used in other
+ * messages answering it. At most 8 commands and 1024 bytes are collected;
+ * a command that does not fit returns -1.
+ * hdmi_batch_submit returns the cmd_id of the batch, 0 if it is empty,
+ * or -1. hdmi_exit, hdmi_subscribe and the synchronous functions are
+ * never batched.
+ */
+int hdmi_batch_begin(void);
+int hdmi_batch_submit(void);
+
+/* Shared memory event ring. After hdmi_event_ring_open, messages from
+ * the service to this connection are written to a ring in shared memory
+ * and read in place, instead of being sent on the socket.
+ * hdmi_event_ring_read returns 1 and the next message, or 0 if there is
+ * none. data points into the ring and is valid until
+ * hdmi_event_ring_release, which must be called before the next read.
+ * hdmi_event_ring_wait returns 1 if there is a message, or 0 if there is
+ * none after timeout_ms. Messages are dropped, and counted in the ring
+ * header, if the ring is full. hdmi_event_ring_close returns to socket
+ * delivery. Only one thread may read the ring.
+ * hdmi_event_ring_open and hdmi_event_ring_close return as the
+ * synchronous functions above. Not available with HDMI_INIT_CALLBACK.
+ */
+int hdmi_event_ring_open(int timeout_ms);
+int hdmi_event_ring_read(__u32 *cmd, __u32 *cmd_id, __u32 *len,
+							__u8 **data);
+void hdmi_event_ring_release(void);
+int hdmi_event_ring_wait(int timeout_ms);
+int hdmi_event_ring_close(int timeout_ms);
+
+/* Shared memory layout, followed by size bytes of data.
+ * Messages are in socket format, cmd, cmd_id, len and data, starting
+ * 4 byte aligned. HDMI_EVENT_RING_PAD instead of cmd: the next message is
+ * at the start of data. head and tail are free running byte counts.
+ */
+struct hdmi_event_ring {
+	__u32 magic;		/* HDMI_EVENT_RING_MAGIC */
+	__u32 size;		/* Power of 2 */
+	__u32 head;		/* Written by service */
+	__u32 waiting;		/* Set by client before sleeping on eventfd */
+	__u32 drops;		/* Messages dropped by service */
+	__u32 reserved0[11];
+	__u32 tail;		/* Written by client, own cache line */
+	__u32 reserved1[15];
+};
+
+#define HDMI_EVENT_RING_MAGIC	0x48455652
+#define HDMI_EVENT_RING_SIZE	0x10000
+#define HDMI_EVENT_RING_PAD	0xFFFFFFFF
+
+/* hdmi_subscribe mask */
+#define HDMI_SUBSCRIBE_PLUG	0x01	/* HDMI_PLUGGED_EV, HDMI_UNPLUGGED_EV */
+#define HDMI_SUBSCRIBE_EDID	0x02	/* HDMI_EDIDRESP */
+#define HDMI_SUBSCRIBE_CEC	0x04	/* HDMI_CECRECVD, HDMI_CECSENDERR */
+#define HDMI_SUBSCRIBE_HDCP	0x08	/* HDMI_HDCPSTATE */
+#define HDMI_SUBSCRIBE_STATE	0x10	/* HDMI_ILLSTATE_*, other errors */
+#define HDMI_SUBSCRIBE_STATS	0x20	/* HDMI_STATSRESP */
+#define HDMI_SUBSCRIBE_CMDDONE	0x40	/* HDMI_CMDDONE */
+#define HDMI_SUBSCRIBE_ALL	0x7F
+
 
 /* Messages from service */
 
@@ -103,6 +212,49 @@ int hdmi_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
  *	state = 5: Authentication fail state
  *	state = 6: Authentication succeed state
  *	state = 7: Encryption on going state
+ *	HDCP bring-up after hdmi_hdcp_init, reported by service:
+ *	state = 0x10: AES keys are being loaded
+ *	state = 0x11: AES keys loaded and verified
+ *	state = 0x12: AES keys load failed
+ *	state = 0x13: HDCP AES OTP is not fused
+ *	state = 4 (Authentication on going) is reported when encryption
+ *	is started.
+ */
+
+/* cmd=HDMI_STATSRESP data format
+ *u8 nr_phases
+ *followed by nr_phases times:
+ *	u8 phase
+ *		phase = 0: stayalive
+ *		phase = 1: HW supported formats read
+ *		phase = 2: EDID block 0 read
+ *		phase = 3: EDID block 0 parse
+ *		phase = 4: EDID extension block read, once per block
+ *		phase = 5: EDID extension block parse, once per block
+ *		phase = 6: best video format selection
+ *		phase = 7: frame buffer creation
+ *		phase = 8: resolution change
+ *		phase = 9: plug handling total
+ *		phase = 10: EDID verification of known sink
+ *	u32 count
+ *	u32 min (us)
+ *	u32 avg (us)
+ *	u32 max (us)
+ *	u32 p99 (us)
+ */
+
+/* cmd=HDMI_CMDDONE data format, cmd_id is the handled command
+ *u32 cmd
+ *s32 result (0 = ok, < 0 = failed)
+ *u32 queue_us	time in command queue
+ *u32 exec_us	time to handle command
+ * Sent only to the connection that sent the command. For HDMI_HDCP_INIT
+ * it is sent when HDCP bring-up has ended.
+ */
+
+/* HDMI_PLUGGED_EV is sent again if the EDID of a known sink, read after
+ * the plug event was sent using its stored profile, has changed the
+ * supported video formats.
  */
 
 /* HDMI message cmd sent from hdmi_service */
@@ -110,12 +262,19 @@ int hdmi_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 #define HDMI_UNPLUGGED_EV		0x11
 #define HDMI_EDIDRESP			0x12
 #define HDMI_CECRECVD			0x13
+#define HDMI_STATSRESP			0x14
+#define HDMI_CMDDONE			0x15
 #define HDMI_ILLSTATE_POWERED		0x80
 #define HDMI_ILLSTATE_UNPOWERED		0x81
 #define HDMI_ILLSTATE_UNPLUGGED		0x82
 #define HDMI_ILLSTATE_PWRON_PLUGGED	0x83
 #define HDMI_CECSENDERR			0x84
 #define HDMI_HDCPSTATE			0x85
+#define HDMI_CMDQUEUE_FULL		0x86	/* Command dropped, cmd_id is
+						 * the dropped command */
+#define HDMI_CMD_TOOLONG		0x87	/* Command longer than service
+						 * limit, skipped */
+#define HDMI_BATCH_INVALID		0x88	/* Batch not handled */
 
 #endif /* #ifdef _HDMI_SERVICE_API_H */
 
@@ -53,12 +53,56 @@ enum hdmi_format {
 	HDMI_FORMAT_DVI
 };
 
+#define CMD_OFFSET		0
+#define CMDID_OFFSET		4
+#define CMDLEN_OFFSET		8
+#define CMDBUF_OFFSET		12
+#define CMD_DATA_MAX	512
+#define CMD_QUEUE_SIZE	32	/* Must be a power of 2 */
+#define CMD_WAITERS_MAX	8	/* Callers of synchronous API functions */
+#define CMD_BATCH_MAX	1024	/* Bytes of commands in a HDMI_BATCH */
+#define CMD_BATCH_CMDS_MAX 8
+#define FORMATS_MAX	35
+#define EDID_BLOCKS_MAX	8	/* Block 0 and extensions read */
+#define EDID_SVDS_MAX	64
+#define EDID_SADS_MAX	10
+#define EDID_SAD_SIZE	3
+#define EDID_Y420_MAX	16
+
 struct cmd_data {
 	__u32 cmd;
 	__u32 cmd_id;
 	__u32 data_len;
-	__u8 data[512];
-	struct cmd_data *next;
+	__u8 data[CMD_DATA_MAX];
+	int client;		/* Sending client index, -1 if none */
+	long long time;		/* Time added to queue, us */
+	unsigned int seq;	/* Owned by command queue */
+};
+
+/* Command to report with HDMI_CMDDONE when it has been handled */
+struct cmd_done {
+	__u32 cmd;
+	__u32 cmd_id;
+	int client;
+	long long queued;	/* Time added to queue, us */
+	long long start;	/* Time handling started, us */
+};
+
+/* Incremental decoder of commands from a client socket */
+struct cmd_decoder {
+	int bytes;		/* Bytes in buffer */
+	__u32 skip;		/* Bytes left of an oversize message */
+	int exit;		/* HDMI_EXIT decoded */
+	int fds[2];		/* Received with SCM_RIGHTS, for HDMI_EVENTRING */
+	int nfds;
+	int packets;		/* SOCK_SEQPACKET, one message per read */
+	__u8 buffer[CMDBUF_OFFSET + CMD_BATCH_MAX];
+};
+
+struct hdmi_event_rec {
+	unsigned int seq;	/* Monotonic sequence number */
+	int event;		/* One HDMIEVENT_ bit */
+	long long time;		/* CLOCK_MONOTONIC, us */
 };
 
 struct video_format {
@@ -73,6 +117,35 @@ struct vesacea {
 	__u8 nr;
 };
 
+/* Set of video formats, bit nr % 64 of map[cea][nr / 64] is format nr */
+#define VESACEA_NR_MAX		128
+#define VESACEA_MAP_WORDS	(VESACEA_NR_MAX / 64)
+struct vesacea_set {
+	__u64 map[2][VESACEA_MAP_WORDS];	/* [0]=VESA, [1]=CEA */
+};
+
+#define TIMING_INTERLACED	0x01
+#define TIMING_RB		0x02	/* Reduced blanking */
+#define TIMING_AR_MASK		0x30
+#define TIMING_AR_4_3		0x10
+#define TIMING_AR_16_9		0x20
+#define TIMING_AR_64_27		0x30
+
+/* Video format timing. Vertical values are per field if interlaced */
+struct video_timing {
+	__u16 xres;
+	__u16 yres;
+	__u32 pixclock;		/* ps */
+	__u16 hfp;
+	__u16 hsync;
+	__u16 hbp;
+	__u16 vfp;
+	__u16 vsync;
+	__u16 vbp;
+	__u8 refresh;		/* Hz */
+	__u8 flags;
+};
+
 struct edid_latency {
 	int video_latency;
 	int audio_latency;
@@ -80,21 +153,136 @@ struct edid_latency {
 	int intlcd_audio_latency;
 };
 
+/* Sink capabilities decoded from the CEA-861 extension blocks */
+struct edid_caps {
+	__u8 nr_blocks;		/* Read, block 0 included */
+	__u8 nr_cea;		/* CEA extension blocks */
+	__u8 hdmi;		/* CEA extension revision 3 or later */
+	__u8 hdmi_vsdb;		/* HDMI VSDB present */
+	__u8 cea_flags;		/* Underscan, basic audio, YCbCr 4:4:4, 4:2:2 */
+	__u8 deep_color;	/* HDMI VSDB byte 6 */
+	__u8 max_tmds;		/* HDMI VSDB, 5 MHz units */
+	__u8 hf_version;	/* HDMI Forum VSDB or SCDB, 0 if none */
+	__u8 hf_max_tmds;	/* 5 MHz units */
+	__u8 hf_flags;		/* SCDC present etc */
+	__u8 hf_dc420;		/* 4:2:0 deep color */
+	__u8 nr_svds;
+	__u8 nr_sads;
+	__u8 nr_y420;
+	__u16 phys_addr;	/* CEC physical address */
+	__u16 speaker;		/* Speaker allocation */
+	__u16 colorimetry;	/* Colorimetry and metadata flags */
+	__u8 svd[EDID_SVDS_MAX];	/* As in EDID, native flag included */
+	__u8 sad[EDID_SADS_MAX][EDID_SAD_SIZE];
+	__u8 y420[EDID_Y420_MAX];	/* VICs only supported as 4:2:0 */
+	__u8 y420_map[EDID_SVDS_MAX / 8];	/* SVDs also supported as 4:2:0 */
+	__u8 nr_dtds;		/* Detailed Timing Descriptors */
+	__u8 native_dtd;	/* native is from the preferred DTD */
+	struct vesacea_set native;	/* Formats of the native timing */
+};
+
+#define SINKPROFILE_KEY_SIZE	9
+
+/* DDC reads of EDID blocks and their failures */
+struct edid_ddc_stats {
+	__u32 reads;
+	__u32 read_errors;	/* No or short response */
+	__u32 header_errors;	/* Block 0 header mismatch */
+	__u32 chksum_errors;	/* Corrupted block */
+};
+
+/* Parsed EDID data of a sink, stored to make replug of known sinks fast */
+struct sink_profile {
+	__u8 key[SINKPROFILE_KEY_SIZE];	/* Vendor, product, serial, chksum */
+	__u8 extension;		/* Number of extension blocks */
+	__u8 ext_chksum;	/* Sum of extension block checksums */
+	__u8 hdmi;
+	__u8 basic_audio;
+	__u8 cea;		/* Last applied video format */
+	__u8 vesaceanr;
+	__u8 nr_supported;
+	struct vesacea supported[FORMATS_MAX];
+	struct edid_latency latency;
+	struct edid_caps caps;
+	__u32 lru;
+	struct edid_ddc_stats ddc;	/* Not compared, saved on new errors */
+};
+
+/* Kernel sysfs files kept open */
+enum sysfs_file {
+	SYSFS_STOREASTEXT,
+	SYSFS_PLUGDETEN,
+	SYSFS_EVCLR,
+	SYSFS_EVWAKEUP,
+	SYSFS_EDIDREAD,
+	SYSFS_HDCPCHKAESOTP,
+	SYSFS_HDCPLOADAES,
+	SYSFS_HDCPSTATEGET,
+	SYSFS_HDCPAUTH,
+	SYSFS_HDCPEVEN,
+	SYSFS_CECSEND,
+	SYSFS_CECRXEVEN,
+	SYSFS_CECREAD,
+	SYSFS_INFOFRSEND,
+	SYSFS_POWERONOFF,
+	SYSFS_DISPONOFF,
+	SYSFS_HDMIFORMAT,
+	SYSFS_VESACEAFORMATS,
+	SYSFS_TIMING,
+	SYSFS_STAYALIVE,
+	SYSFS_FILES_MAX
+};
+
+enum hdmi_phase {
+	PHASE_STAYALIVE,
+	PHASE_HWFORMATS,
+	PHASE_EDID0_READ,
+	PHASE_EDID0_PARSE,
+	PHASE_EDID1_READ,
+	PHASE_EDID1_PARSE,
+	PHASE_BESTFORMAT,
+	PHASE_FBCREATE,
+	PHASE_CHRES,
+	PHASE_PLUG_TOTAL,
+	PHASE_VERIFY,
+	PHASE_MAX
+};
+
 typedef void(*cb_fn)(int cmd, int data_length, __u8 *data);
 
+void dispatch_callback_set(cb_fn hdmi_cb);
+cb_fn dispatch_callback_get(void);
+
 int cecrx_subscribe(void);
 int cecsend(__u32 cmd_id, __u8 in, __u8 dest, __u8 len, __u8 *data);
 int cecrx(void);
 int edid_read(__u8 block, __u8 *data);
-int edid_parse0(__u8 *data, __u8 *extension, struct video_format *, int size);
-int edid_parse1(__u8 *data, struct video_format formats[], int nr_formats,
-		int *basic_audio_support, struct edid_latency *edid_latency,
-		int *hdmi);
+int edid_block_check(__u8 block, __u8 *data, int size);
+int edid_acquire(__u8 block, __u8 *data, int deadline_us);
+int edid_ddc_stats_take(struct edid_ddc_stats *sum);
+int edid_parse0(__u8 *data, __u8 *extension, struct vesacea_set *sink,
+		struct edid_caps *caps);
+int edid_parse_ext(__u8 *data, struct vesacea_set *sink,
+		struct edid_caps *caps, struct edid_latency *edid_latency);
 int edidreq(__u8 block, __u32 cmd_id);
 int hdcp_init(__u8 *aes);
+int hdcp_done_defer(struct cmd_done *done);
 int hdcp_state(void);
+void hdcp_abort(void);
+int hdcp_timeout_get(void);
+int hdcp_timer(void);
 int video_formats_clear(void);
 int vesacea_supported(int *nr_supported, struct vesacea vesacea[]);
+int video_format_supported(__u8 cea, __u8 vesaceanr);
+int video_formats_sink_set(int nr_supported, struct vesacea vesacea[]);
+void video_formats_sink_map(struct vesacea_set *sink);
+void video_formats_native_set(struct vesacea_set *native);
+void vesacea_set_add(struct vesacea_set *set, __u8 cea, __u8 nr);
+int vesacea_set_test(struct vesacea_set *set, __u8 cea, __u8 nr);
+void vesacea_set_add_set(struct vesacea_set *set, struct vesacea_set *add);
+const struct video_timing *timing_get(__u8 cea, __u8 nr);
+int timing_dmt_find(int xres, int yres, int refresh);
+int timing_match(const struct video_timing *t, struct vesacea_set *set);
 int video_formats_supported_hw(void);
 int nr_formats_get(void);
 struct video_format *video_formats_get(void);
@@ -103,48 +291,143 @@ int hdmi_fb_chres(__u8 cea, __u8 vesaceanr);
 int vesaceaprio_set(__u8 len, __u8 *data);
 void vesacea_prio_default(void);
 int hdmievclr(__u8 mask);
-void thread_kevent_fn(void *arg);
+int kevent_thread_start(void);
+void kevent_thread_stop(void);
 int hdmiplug_subscribe(void);
 int hdmi_event(int event);
 int get_best_videoformat(__u8 *cea, __u8 *vesaceanr);
 int listensocket_set(int sock);
 int listensocket_get(void);
-int clientsocket_get(void);
+void socket_type_set(int type);
+void cmd_decoder_init(struct cmd_decoder *dec);
+void cmd_decoder_exit(struct cmd_decoder *dec);
+int cmd_decode(struct cmd_decoder *dec, int sock, int index);
+int cmd_decode_batch(__u8 *msg, __u32 len, __u32 cmd_id, int index);
+int illegalstate_send(__u32 cmd, __u32 cmd_id);
+int sockclient_register(int sock);
+void sockclient_unregister(int index);
+int sockclient_flush(int index);
+int sockclient_pending(int index);
+void sockclient_stats_dump(void);
+int sockclient_subscribe(int index, __u32 mask);
+int sockclient_ring_attach(int index, int memfd, int evfd);
+struct eventring;
+struct eventring *eventring_attach(int memfd, int evfd);
+void eventring_detach(struct eventring *er);
+int eventring_put(struct eventring *er, __u8 *buf, int len);
+struct hdmi_event_ring *eventring_create(__u32 size, int *memfd, int *evfd);
+void eventring_destroy(struct hdmi_event_ring *ring);
+int eventring_read(struct hdmi_event_ring *ring, __u32 *cmd, __u32 *cmd_id,
+					__u32 *len, __u8 **data);
+void eventring_release(struct hdmi_event_ring *ring);
+int eventring_wait(struct hdmi_event_ring *ring, int evfd, int timeout_ms);
 int cecsenderr(void);
 int get_new_cmd_id_ind(void);
+int cmd_submit(__u32 cmd, __u32 len, __u8 *data);
+int cmd_submit_wait(__u32 cmd, __u32 len, __u8 *data, int timeout_ms);
+int cmd_done_send(struct cmd_done *done, int result);
+int cmd_wait_register(__u32 cmd_id);
+void cmd_wait_unregister(int index);
+void cmd_wait_complete(__u32 cmd_id, int result);
+int cmd_wait(int index, int timeout_ms);
 void thread_socklisten_fn(void *arg);
-int cmd_add(struct cmd_data *cmd);
+void sockclient_stop_all(void);
+int sockclient_start(int sock);
+int cmd_add(__u32 cmd, __u32 cmd_id, int client, __u32 len, __u8 *data);
+struct cmd_data *cmd_alloc(__u32 cmd, __u32 cmd_id, int client);
+struct cmd_data *cmd_reserve(void);
+struct cmd_data *cmd_reserve_n(unsigned int nr);
+struct cmd_data *cmd_next(struct cmd_data *slot);
+void cmd_commit(struct cmd_data *slot);
+void cmd_overflow(__u32 cmd, __u32 cmd_id);
 int serversocket_create(int avoid_return_msg);
+int serversocket_direct(int reactor, int *client);
 int serversocket_write(int len, __u8 *data);
+struct iovec;
+int serversocket_writev(struct iovec *iov, int iovcnt);
+int serversocket_sendfds(__u8 *buf, int len, int *fds, int nfds);
 int serversocket_close(void);
 int poweronoff(__u8 onoff);
 int clientsocket_send(__u8 *buf, int len);
+int clientsocket_send_to(int index, __u8 *buf, int len);
+int dispatch_post(__u8 *buf, int len);
+int dispatch_start(void);
+void dispatch_stop(void);
 int dispdevice_file_open(char *file, int attr);
-
-int hdmi_service_init(int avoid_return_msg);
+int dispdevice_uevent_check(void);
+int dispdevice_wait(int timeout);
+int dispdevice_present(void);
+int dispdevice_init(void);
+void dispdevice_exit(void);
+
+int hdmi_cmd_handle(struct cmd_data *cmd_obj);
+int hdmi_events_handle(void);
+void hdmi_events_clear(void);
+int hdmi_event_queue(int event);
+long long hdmi_time_us(void);
+int hdmi_timeout_get(void);
+void hdmi_timers_run(void);
+int hdmi_service_exit_do(void);
+void hdmi_service_ready(int ok);
+int hdmieventfile_fd_open(void);
+int hdmieventfile_read(int fd);
+int hdmieventfile_close(int fd);
+int listensocket_create(void);
+void thread_reactor_fn(void *arg);
+void reactor_wakeup(void);
+int reactor_client_add(int sock);
+
+int sysfs_open(enum sysfs_file file);
+int sysfs_read(enum sysfs_file file, void *buf, int size);
+int sysfs_write(enum sysfs_file file, const void *buf, int size);
+void sysfs_dispdevice_close(void);
+void sysfs_close_all(void);
+int sinkprofile_key(__u8 *edid0, __u8 *key);
+struct sink_profile *sinkprofile_find(__u8 *edid0);
+int sinkprofile_store(struct sink_profile *profile);
+void sinkprofile_dump(void);
+void stats_clear(void);
+long long stats_phase_end(int phase, long long start);
+int stats_phase_get(int phase, unsigned int *count, unsigned int *min,
+		unsigned int *avg, unsigned int *max, unsigned int *p99);
+void stats_dump(void);
+int stats_send(__u32 cmd_id);
+
+int hdmi_service_init(int flags);
 int hdmi_service_exit(void);
 int hdmi_service_enable(void);
 int hdmi_service_disable(void);
 
-#ifdef HDMI_SERVICE_USE_CALLBACK_FN
 void hdmi_service_callback_set(cb_fn hdmi_cb);
 cb_fn hdmi_service_callback_get(void);
-#endif /*HDMI_SERVICE_USE_CALLBACK_FN*/
 
 int hdmi_service_resolution_set(int cea, int vesaceanr);
+int hdmi_service_resolution_set_sync(int cea, int vesaceanr, int timeout_ms);
 int hdmi_service_fb_release(void);
 int hdmi_service_cec_send(__u8 initiator, __u8 destination, __u8 data_size,
 							__u8 *data);
 int hdmi_service_edid_request(__u8 block);
+int hdmi_service_edid_request_sync(__u8 block, int timeout_ms);
 int hdmi_service_hdcp_init(__u16 aes_size, __u8 *aes_data);
+int hdmi_service_hdcp_init_sync(__u16 aes_size, __u8 *aes_data,
+							int timeout_ms);
 int hdmi_service_infoframe_send(__u8 type, __u8 version, __u8 crc,
 						__u8 data_size, __u8 *data);
 int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 				__u8 vesa_cea2, __u8 nr2,
 				__u8 vesa_cea3, __u8 nr3);
+int hdmi_service_stats_request(void);
+int hdmi_service_subscribe(__u32 mask);
+int hdmi_service_batch_begin(void);
+int hdmi_service_batch_submit(void);
+int hdmi_service_event_ring_open(int timeout_ms);
+int hdmi_service_event_ring_read(__u32 *cmd, __u32 *cmd_id, __u32 *len,
+							__u8 **data);
+void hdmi_service_event_ring_release(void);
+int hdmi_service_event_ring_wait(int timeout_ms);
+int hdmi_service_event_ring_close(int timeout_ms);
 
 #define AES_KEYS_SIZE	297
-#define FORMATS_MAX	35
 
 #define false 0
 #define true 1
@@ -169,6 +452,12 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 #define SOCKET_LISTEN_PATH	"/dev/hdmi_listen"
 #endif
 
+#ifdef ANDROID
+#define SINKPROFILE_FILE	"/data/misc/hdmi_sinkprofiles"
+#else
+#define SINKPROFILE_FILE	"/var/lib/hdmi_sinkprofiles"
+#endif
+
 #define STOREASTEXT_FILE	"/sys/class/misc/hdmi/storeastext"
 #define PLUGDETEN_FILE		"/sys/class/misc/hdmi/plugdeten"
 #define EVENT_FILE		"/sys/class/misc/hdmi/evread"
@@ -205,6 +494,10 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 #define HDMI_USER_EVSTR		"20"
 
 #define EDIDREAD_SIZE		0x80
+#define EDID_BLOCK_SIZE		0x80
+#define EDIDREAD_BUF_SIZE	(EDID_BLOCK_SIZE + 1)	/* Leading byte */
+#define EDID_DDC_ADDR		0xA0
+#define EDID_SEGMENT_BLOCKS	2	/* Blocks per E-DDC segment */
 #define POLL_READ_SIZE		1
 #define CEAPRIO_MAX_SIZE	10
 #define VESACEAPRIO_DEFAULT	254
@@ -226,13 +519,13 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 
 #define EVENTMASK_ALL		0xFF
 #define EVENTMASK_PLUG		0x03
+/* Events only requesting a check of current state, may be coalesced */
+#define EVENTMASK_COALESCE	(HDMIEVENT_HDCP | HDMIEVENT_WAKEUP | \
+				HDMIEVENT_CMD)
+#define EVENT_JOURNAL_SIZE	64
 
 /* User commands */
 #define HDMIEVENT_CMD		0x010000
-#define CMD_OFFSET		0
-#define CMDID_OFFSET		4
-#define CMDLEN_OFFSET		8
-#define CMDBUF_OFFSET		12
 
 
 #define LOADAES_OK		0
@@ -247,10 +540,13 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 #define EDIDREAD_NOEXT		-4
 #define EDIDREAD_NOVIDEO	-5
 #define EDIDREAD_BL1_TAG_REV_ERR -6
+#define EDIDREAD_CHKSUM_FAIL	-7
 #define HDCP_OK			0
 #define AESKEYS_FAIL		-1
 #define HDCPSTATE_FAIL		-2
 #define HDCPAUTHENCR_FAIL	-3
+#define HDCPAUTH_FAIL		-4
+#define HDCP_ABORTED		-5
 
 #define EDID_BL0_HEADER_OFFSET		0x00
 #define EDID_BL0_VERSION_OFFSET		0x12
@@ -261,6 +557,11 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 #define EDID_BL0_ESTTIM1_OFFSET		0x23
 #define EDID_BL0_ESTTIM2_OFFSET		0x24
 #define EDID_BL0_STDTIM1_OFFSET		0x26
+#define EDID_BL0_FEATURE_OFFSET		0x18
+#define EDID_BL0_DTD1_OFFSET		0x36
+#define EDID_BL0_DTDS			4
+#define EDID_FEATURE_PREFERRED		0x02	/* First DTD is native */
+#define EDID_REVISION_4			4
 #define EDID_BL1_TAG_OFFSET		0x00
 #define EDID_BL1_REVNR_OFFSET		0x01
 #define EDID_BL1_OFFSET_OFFSET		0x02
@@ -282,8 +583,19 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 #define EDID_BLK_CODE_MSK		0xE0
 #define EDID_BLK_CODE_SHIFT		5
 #define EDID_BLK_LENGTH_MSK		0x1F
+#define EDID_CODE_AUDIO			0x01
 #define EDID_CODE_VIDEO			0x02
 #define EDID_CODE_VSDB			0x03
+#define EDID_CODE_SPEAKER		0x04
+#define EDID_CODE_EXT			0x07
+#define EDID_EXT_COLORIMETRY		0x05
+#define EDID_EXT_Y420VDB		0x0E
+#define EDID_EXT_Y420CMDB		0x0F
+#define EDID_EXT_HF_SCDB		0x79
+#define EDID_OUI_HDMI			0x000C03
+#define EDID_OUI_HDMI_FORUM		0xC45DD8
+#define EDID_SVD_NATIVE_MIN		129
+#define EDID_SVD_NATIVE_MAX		192
 #define EDID_BL0_STDTIM1_SIZE		8
 #define EDID_BL1_STDTIM9_SIZE		6
 #define EDID_STDTIM_AR_MASK		0xC0
@@ -291,7 +603,10 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 #define EDID_STDTIM_FREQ_MASK		0x3F
 #define EDID_STDTIM_FREQ_SHIFT		0
 #define EDID_BASIC_AUDIO_SUPPORT_MASK	0x40
+#define EDID_VSD_OUI_END		3
 #define EDID_VSD_PHYS_SRC		4
+#define EDID_VSD_DEEPCOLOR		6
+#define EDID_VSD_MAX_TMDS		7
 #define EDID_VSD_LATENCY_IND		8
 #define EDID_VSD_LAT_FLD_MASK		0x80
 #define EDID_VSD_INTLCD_LAT_FLD_MASK	0x40
@@ -299,6 +614,27 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 #define EDID_VSD_AUD_LAT		10
 #define EDID_VSD_INTLCD_VID_LAT		11
 #define EDID_VSD_INTLCD_AUD_LAT		12
+#define EDID_HF_VERSION			4
+#define EDID_HF_MAX_TMDS		5
+#define EDID_HF_FLAGS			6
+#define EDID_HF_DC420			7
+#define EDID_DTD_SIZE			18
+#define EDID_DTD_PIXCLK			0	/* 10 kHz units, 0 if no DTD */
+#define EDID_DTD_HACT			2
+#define EDID_DTD_HBLANK			3
+#define EDID_DTD_HHIGH			4
+#define EDID_DTD_VACT			5
+#define EDID_DTD_VBLANK			6
+#define EDID_DTD_VHIGH			7
+#define EDID_DTD_HFP			8
+#define EDID_DTD_HSYNC			9
+#define EDID_DTD_VFP_VSYNC		10
+#define EDID_DTD_SYNC_HIGH		11
+#define EDID_DTD_HMM			12	/* Image size, mm */
+#define EDID_DTD_VMM			13
+#define EDID_DTD_MM_HIGH		14
+#define EDID_DTD_FLAGS			17
+#define EDID_DTD_INTERLACED		0x80
 
 /* HDCP states */
 #define HDCP_STATE_NO_RECV		0
@@ -309,18 +645,65 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 #define HDCP_STATE_AUTH_FAIL		5
 #define HDCP_STATE_AUTH_SUCCEDED	6
 #define HDCP_STATE_ENCR_ONGOING		7
+/* HDCP bring-up states reported by the service */
+#define HDCP_STATE_AES_LOADING		0x10
+#define HDCP_STATE_AES_OK		0x11
+#define HDCP_STATE_AES_FAIL		0x12
+#define HDCP_STATE_OTP_UNPROGGED	0x13
 
 #define VIDEO_FORMAT_DEFAULT	1	/* 640x480@60P */
 
 #define STARTUP_DELAY_US	6000000
 #define HDCPAUTH_WAITTIME	1000000
 #define LOADAES_WAITTIME	250000
-#define EDIDREAD_WAITTIME0	2000000
-#define EDIDREAD_WAITTIME1	100000
+#define EDIDREAD_DEADLINE0	4000000	/* Total time for EDID block 0 */
+#define EDIDREAD_DEADLINE1	300000	/* Total time for an extension block */
+#define EDID_RETRY_MIN_US	10000
+#define EDID_RETRY_MAX_US	400000
 
 /* Socket listen thread */
-#define SOCKET_DATA_MAX 256
-#define SOCKET_MAX_CONN 1
+#define SOCKET_MAX_CONN 4
+
+#define SOCKET_CLIENTS_MAX 4
+#define SOCKET_CLIENT_CALLBACK SOCKET_CLIENTS_MAX	/* Pseudo client */
+#define SOCKET_OUTQ_SIZE 4096	/* Per client, > largest message */
+#define SOCKET_DROPS_MAX 16
+#define SOCKET_PACKETS_MAX 8	/* SOCK_SEQPACKET packets per client read */
+
+/* Shared memory event ring data size limits */
+#define EVENTRING_SIZE_MIN	0x1000
+#define EVENTRING_SIZE_MAX	0x100000
+
+/* Callback dispatcher thread */
+#define DISPATCH_QUEUE_SIZE	32
+#define DISPATCH_DATA_MAX	CMD_DATA_MAX
+
+/* Reactor thread */
+#define REACTOR_EVENTS_MAX	8
+
+/* Phase timing statistics */
+#define STATS_SAMPLES		128
+#define STATS_PHASE_SIZE	21	/* u8 phase, 5 * u32 */
+
+/* HDMI_CMDDONE data: u32 cmd, s32 result, u32 queue_us, u32 exec_us */
+#define CMDDONE_SIZE		16
+
+/* Sink profile store */
+#define SINKPROFILE_MAX		8
+#define SINKPROFILE_MAGIC	0x48534b50	/* "HSKP" */
+#define SINKPROFILE_VERSION	2
+#define EDID_BL0_VENDOR_OFFSET	0x08
+#define EDID_CHKSUM_OFFSET	0x7F
+
+/* Display device */
+#define UEVENT_MSG_MAX		2048
+#define UEVENT_BUF_SIZE		(64 * 1024)
+#define STAYALIVE_WAIT_US	6000000
+#define STAYALIVE_SETTLE_MS	20
+#define STAYALIVE_POLL_MS	200	/* Wait for device add, or rescan */
+
+/* Service start */
+#define SERVICE_READY_TIMEOUT	5	/* s */
 
 /* Command format */
 /* Message data format
@@ -336,7 +719,7 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 #define HDMI_DISABLE		0x2
 
 /* cmd=HDMI_EDIDREQ data format
- *u8 block (0 or 1)
+ *u8 block (0 to EDID_BLOCKS_MAX - 1)
  */
 #define HDMI_EDIDREQ		0x3
 
@@ -382,6 +765,29 @@ int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
  */
 #define HDMI_INFOFR		0x9
 
+#define HDMI_STATSREQ		0xA
+
+/* cmd=HDMI_SUBSCRIBE data format
+ *u32 mask	HDMI_SUBSCRIBE_* message types sent to this connection
+ */
+#define HDMI_SUBSCRIBE		0xB
+
+/* cmd=HDMI_BATCH data format
+ *Commands, each with cmd, cmd_id, len and data, at most CMD_BATCH_MAX
+ *bytes and CMD_BATCH_CMDS_MAX commands. HDMI_BATCH, HDMI_SUBSCRIBE and
+ *HDMI_EXIT can not be batched.
+ *The commands are handled in one pass and only the batch is answered
+ *with HDMI_CMDDONE, with the first failed result.
+ */
+#define HDMI_BATCH		0xC
+
+/* cmd=HDMI_EVENTRING data format
+ *u32 size	0: stop using the event ring
+ *With size > 0, a memfd and an eventfd are passed with SCM_RIGHTS, see
+ *struct hdmi_event_ring. Can not be batched.
+ */
+#define HDMI_EVENTRING		0xD
+
 #define HDMI_EXIT		0xFF
 
 
@@ -57,19 +57,10 @@ static int cectxcmdid_get(void)
 /* Subscribe for incoming CEC messages */
 int cecrx_subscribe(void)
 {
-	int cecrxfd;
-	int ret = 0;
-
-	cecrxfd = open(CECRXEVEN_FILE, O_WRONLY);
-	if (cecrxfd < 0) {
-		LOGHDMILIB(" failed to open %s", CECRXEVEN_FILE);
-		return -1;
-	}
-	if (write(cecrxfd, cecrxeven_val, sizeof(cecrxeven_val)) !=
-			sizeof(cecrxeven_val))
-		ret = -2;
-	close(cecrxfd);
-	return ret;
+	if (sysfs_write(SYSFS_CECRXEVEN, cecrxeven_val,
+				sizeof(cecrxeven_val)) != sizeof(cecrxeven_val))
+		return -2;
+	return 0;
 }
 
 int cecsenderr(void)
@@ -93,7 +84,6 @@ int cecsenderr(void)
 /* Send CEC message */
 int cecsend(__u32 cmd_id, __u8 in, __u8 dest, __u8 len, __u8 *data)
 {
-	int cecsendfd;
 	int res;
 	char buf[128];
 
@@ -108,21 +98,12 @@ int cecsend(__u32 cmd_id, __u8 in, __u8 dest, __u8 len, __u8 *data)
 	memcpy(&buf[3], data, len);
 
 	/* Send CEC cmd */
-	cecsendfd = open(CECSEND_FILE, O_WRONLY);
-	if (cecsendfd <= 0) {
-		LOGHDMILIB("***** Failed to open %s *****\n", CECSEND_FILE);
-		goto cecsend_err;
-	}
-
-	res = write(cecsendfd, buf, len + 3);
+	res = sysfs_write(SYSFS_CECSEND, buf, len + 3);
 	if (res != len + 3) {
 		LOGHDMILIB("***** cecsend failed %d *****\n", res);
-		close(cecsendfd);
 		goto cecsend_err;
 	}
 
-	close(cecsendfd);
-
 	LOGHDMILIB("%s end", __func__);
 	return 0;
 
@@ -135,7 +116,6 @@ cecsend_err:
 /* Read received CEC message and forward on client socket */
 int cecrx(void)
 {
-	int cecreadfd;
 	__u8 buf[32];
 	__u8 cecdata[32];
 	int cecsize;
@@ -147,13 +127,7 @@ int cecrx(void)
 	LOGHDMILIB("%s begin", __func__);
 
 	cmd_id = get_new_cmd_id_ind();
-	cecreadfd = open(CECREAD_FILE, O_RDONLY);
-	if (cecreadfd < 0) {
-		LOGHDMILIB("***** Failed to open %s *****", CECREAD_FILE);
-		return -1;
-	}
-	cecsize = read(cecreadfd, buf, sizeof(buf));
-	close(cecreadfd);
+	cecsize = sysfs_read(SYSFS_CECREAD, buf, sizeof(buf));
 
 	if (cecsize < 0)
 		return -1;
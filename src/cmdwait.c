@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * Author: Per Persson per.xb.persson@stericsson.com for
+ * ST-Ericsson.
+ *
+ * License terms:
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <unistd.h>     /* Symbolic Constants */
+#include <sys/types.h>  /* Primitive System Data Types */
+#include <linux/types.h>
+#include <errno.h>      /* Errors */
+#include <stdarg.h>
+#include <stdio.h>      /* Input/Output */
+#include <stdlib.h>     /* General Utilities */
+#include <pthread.h>    /* POSIX Threads */
+#include <string.h>     /* String handling */
+#include <time.h>
+#ifdef ANDROID
+#include <utils/Log.h>
+#endif
+#include "../include/hdmi_service_api.h"
+#include "../include/hdmi_service_local.h"
+
+/*
+ * Callers waiting for completion of a command they have sent.
+ * A waiter is registered with the cmd_id before the command is sent, and
+ * is completed from cmd_done_send. All waiters share one condition, they
+ * are few and a completion is rare compared to the wait.
+ */
+struct cmd_waiter {
+	__u32 cmd_id;
+	int used;
+	int done;
+	int result;
+};
+
+static struct cmd_waiter cmd_waiters[CMD_WAITERS_MAX];
+static int cmd_waiters_used;
+static pthread_mutex_t cmd_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cmd_wait_cond;
+static pthread_once_t cmd_wait_once = PTHREAD_ONCE_INIT;
+
+static void cmd_wait_cond_init(void)
+{
+	pthread_condattr_t condattr;
+
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cmd_wait_cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+}
+
+/* Register a waiter for command cmd_id.
+ * Returns the waiter index, or -1 if all waiters are used.
+ */
+int cmd_wait_register(__u32 cmd_id)
+{
+	int index;
+
+	pthread_once(&cmd_wait_once, cmd_wait_cond_init);
+
+	pthread_mutex_lock(&cmd_wait_mutex);
+	for (index = 0; index < CMD_WAITERS_MAX; index++)
+		if (!cmd_waiters[index].used)
+			break;
+	if (index == CMD_WAITERS_MAX) {
+		pthread_mutex_unlock(&cmd_wait_mutex);
+		LOGHDMILIB("%s no free waiter for cmd_id:%x", __func__,
+								cmd_id);
+		return -1;
+	}
+	cmd_waiters[index].cmd_id = cmd_id;
+	cmd_waiters[index].used = 1;
+	cmd_waiters[index].done = 0;
+	__atomic_add_fetch(&cmd_waiters_used, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&cmd_wait_mutex);
+	return index;
+}
+
+/* Free a waiter. cmd_wait_mutex must be held */
+static void cmd_wait_free(int index)
+{
+	cmd_waiters[index].used = 0;
+	__atomic_sub_fetch(&cmd_waiters_used, 1, __ATOMIC_RELEASE);
+}
+
+/* Free a waiter whose command was never sent */
+void cmd_wait_unregister(int index)
+{
+	pthread_mutex_lock(&cmd_wait_mutex);
+	cmd_wait_free(index);
+	pthread_mutex_unlock(&cmd_wait_mutex);
+}
+
+/* Complete the waiter of command cmd_id, if any, with result */
+void cmd_wait_complete(__u32 cmd_id, int result)
+{
+	int index;
+
+	/* Nobody waits, the common case */
+	if (__atomic_load_n(&cmd_waiters_used, __ATOMIC_ACQUIRE) == 0)
+		return;
+
+	pthread_mutex_lock(&cmd_wait_mutex);
+	for (index = 0; index < CMD_WAITERS_MAX; index++) {
+		if (cmd_waiters[index].used &&
+				(cmd_waiters[index].cmd_id == cmd_id)) {
+			cmd_waiters[index].done = 1;
+			cmd_waiters[index].result = result;
+			pthread_cond_broadcast(&cmd_wait_cond);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cmd_wait_mutex);
+}
+
+/* Wait until the command of waiter index is completed, at most timeout_ms.
+ * The waiter is freed. Returns the command result, or -ETIMEDOUT.
+ */
+int cmd_wait(int index, int timeout_ms)
+{
+	struct timespec deadline;
+	__u32 cmd_id;
+	int res = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&cmd_wait_mutex);
+	while (!cmd_waiters[index].done && (res == 0))
+		res = pthread_cond_timedwait(&cmd_wait_cond, &cmd_wait_mutex,
+								&deadline);
+	if (cmd_waiters[index].done)
+		res = cmd_waiters[index].result;
+	else
+		res = -ETIMEDOUT;
+	cmd_id = cmd_waiters[index].cmd_id;
+	cmd_wait_free(index);
+	pthread_mutex_unlock(&cmd_wait_mutex);
+
+	if (res == -ETIMEDOUT)
+		LOGHDMILIB("%s cmd_id:%x timed out", __func__, cmd_id);
+	return res;
+}
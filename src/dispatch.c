@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * Author: Per Persson per.xb.persson@stericsson.com for
+ * ST-Ericsson.
+ *
+ * License terms:
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <unistd.h>     /* Symbolic Constants */
+#include <sys/types.h>  /* Primitive System Data Types */
+#include <linux/types.h>
+#include <errno.h>      /* Errors */
+#include <stdarg.h>
+#include <stdio.h>      /* Input/Output */
+#include <stdlib.h>     /* General Utilities */
+#include <pthread.h>    /* POSIX Threads */
+#include <string.h>     /* String handling */
+#ifdef ANDROID
+#include <utils/Log.h>
+#endif
+#include "../include/hdmi_service_api.h"
+#include "../include/hdmi_service_local.h"
+
+/*
+ * Callback delivery, HDMI_INIT_CALLBACK mode.
+ * Messages from the service are posted here instead of being written to
+ * a socket. They are copied once, already decoded, to a ring, and the
+ * dispatcher thread calls the application callback outside of the
+ * service threads. A slow callback never blocks the service: a message
+ * that does not fit in the ring is dropped and counted.
+ */
+struct dispatch_msg {
+	__u32 cmd;
+	__u32 len;
+	__u8 data[DISPATCH_DATA_MAX];
+};
+
+static struct dispatch_msg dispatch_ring[DISPATCH_QUEUE_SIZE];
+static unsigned int dispatch_head;	/* Next to post */
+static unsigned int dispatch_tail;	/* Next to deliver */
+static int dispatch_run;
+static unsigned int dispatch_delivered;
+static unsigned int dispatch_dropped;
+static cb_fn dispatch_callback;
+static pthread_t thread_dispatch;
+static pthread_mutex_t dispatch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dispatch_cond = PTHREAD_COND_INITIALIZER;
+
+void dispatch_callback_set(cb_fn hdmi_cb)
+{
+	pthread_mutex_lock(&dispatch_mutex);
+	dispatch_callback = hdmi_cb;
+	pthread_mutex_unlock(&dispatch_mutex);
+}
+
+cb_fn dispatch_callback_get(void)
+{
+	cb_fn callback;
+
+	pthread_mutex_lock(&dispatch_mutex);
+	callback = dispatch_callback;
+	pthread_mutex_unlock(&dispatch_mutex);
+	return callback;
+}
+
+/* Post message in wire format, header and data, for delivery.
+ * Returns 0, or -1 if it was dropped.
+ */
+int dispatch_post(__u8 *buf, int len)
+{
+	struct dispatch_msg *msg;
+	__u32 data_len;
+	int res = 0;
+
+	if (len < CMDBUF_OFFSET)
+		return -1;
+	data_len = len - CMDBUF_OFFSET;
+	if (data_len > DISPATCH_DATA_MAX)
+		return -1;
+
+	pthread_mutex_lock(&dispatch_mutex);
+	if (!dispatch_run ||
+		(dispatch_head - dispatch_tail >= DISPATCH_QUEUE_SIZE)) {
+		dispatch_dropped++;
+		res = -1;
+		goto dispatch_post_end;
+	}
+
+	msg = &dispatch_ring[dispatch_head % DISPATCH_QUEUE_SIZE];
+	memcpy(&msg->cmd, &buf[CMD_OFFSET], 4);
+	msg->len = data_len;
+	memcpy(msg->data, &buf[CMDBUF_OFFSET], data_len);
+	dispatch_head++;
+	pthread_cond_signal(&dispatch_cond);
+
+dispatch_post_end:
+	pthread_mutex_unlock(&dispatch_mutex);
+	return res;
+}
+
+/* Dispatcher thread. Calls callback for each posted message in order */
+static void thread_dispatch_fn(void *arg)
+{
+	struct dispatch_msg *msg;
+	cb_fn callback;
+
+	LOGHDMILIB("%s begin", __func__);
+
+	pthread_mutex_lock(&dispatch_mutex);
+	for (;;) {
+		while (dispatch_run && (dispatch_head == dispatch_tail))
+			pthread_cond_wait(&dispatch_cond, &dispatch_mutex);
+		if (dispatch_head == dispatch_tail)
+			break;
+
+		/* Slot is not reused until tail has passed it */
+		msg = &dispatch_ring[dispatch_tail % DISPATCH_QUEUE_SIZE];
+		callback = dispatch_callback;
+		pthread_mutex_unlock(&dispatch_mutex);
+
+		if (callback)
+			callback(msg->cmd, msg->len, msg->data);
+
+		pthread_mutex_lock(&dispatch_mutex);
+		dispatch_tail++;
+		dispatch_delivered++;
+	}
+	pthread_mutex_unlock(&dispatch_mutex);
+
+	LOGHDMILIB("%s end", __func__);
+	pthread_exit(NULL);
+}
+
+int dispatch_start(void)
+{
+	pthread_mutex_lock(&dispatch_mutex);
+	dispatch_head = 0;
+	dispatch_tail = 0;
+	dispatch_delivered = 0;
+	dispatch_dropped = 0;
+	dispatch_run = 1;
+	pthread_mutex_unlock(&dispatch_mutex);
+
+	if (pthread_create(&thread_dispatch, NULL, (void *)thread_dispatch_fn,
+								NULL)) {
+		dispatch_run = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/* Deliver what is posted, then end the dispatcher thread */
+void dispatch_stop(void)
+{
+	pthread_mutex_lock(&dispatch_mutex);
+	if (!dispatch_run) {
+		pthread_mutex_unlock(&dispatch_mutex);
+		return;
+	}
+	dispatch_run = 0;
+	pthread_cond_signal(&dispatch_cond);
+	pthread_mutex_unlock(&dispatch_mutex);
+
+	/* hdmi_exit may be called from the callback */
+	if (!pthread_equal(pthread_self(), thread_dispatch))
+		pthread_join(thread_dispatch, NULL);
+	else
+		pthread_detach(thread_dispatch);
+
+	LOGHDMILIB("callbacks delivered:%u dropped:%u", dispatch_delivered,
+							dispatch_dropped);
+}
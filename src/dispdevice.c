@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * Author: Per Persson per.xb.persson@stericsson.com for
+ * ST-Ericsson.
+ *
+ * License terms:
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <unistd.h>     /* Symbolic Constants */
+#include <sys/types.h>  /* Primitive System Data Types */
+#include <linux/types.h>
+#include <errno.h>      /* Errors */
+#include <stdarg.h>
+#include <stdio.h>      /* Input/Output */
+#include <stdlib.h>     /* General Utilities */
+#include <pthread.h>    /* POSIX Threads */
+#include <string.h>     /* String handling */
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#ifdef ANDROID
+#include <utils/Log.h>
+#endif
+#include "../include/hdmi_service_api.h"
+#include "../include/hdmi_service_local.h"
+
+/*
+ * Display device directory, e.g. /sys/devices/av8100_hdmi.3/.
+ * The directory is found once and cached. Kernel uevents for the display
+ * device tell when it is added or removed; the cached path and the sysfs
+ * files opened in it are then invalidated.
+ */
+static char dispdevice_path[64];
+static pthread_mutex_t dispdevice_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int uevent_fd = -1;
+
+static int dispdevice_filter(const struct dirent *dirent)
+{
+	return strncmp(dirent->d_name, DISPDEVICE_PATH_2,
+				strlen(DISPDEVICE_PATH_2)) == 0;
+}
+
+/* Find the correct device path since the device minor number can vary.
+ * dispdevice_mutex must be held.
+ */
+static int dispdevice_path_set(void)
+{
+	struct dirent **namelist;
+	int n;
+
+	n = scandir(DISPDEVICE_PATH_1, &namelist, dispdevice_filter,
+								alphasort);
+	if (n < 0) {
+		LOGHDMILIB("%s", "scandir error");
+		return -1;
+	}
+
+	if ((n > 0) && (snprintf(dispdevice_path, sizeof(dispdevice_path),
+			"%s", namelist[0]->d_name) < (int)sizeof(dispdevice_path)))
+		LOGHDMILIB("%s found:%s", __func__, dispdevice_path);
+	else
+		dispdevice_path[0] = 0;
+	while (n--)
+		free(namelist[n]);
+	free(namelist);
+	return dispdevice_path[0] ? 0 : -1;
+}
+
+int dispdevice_file_open(char *file, int attr)
+{
+	int fd = -1;
+	char fname[128];
+
+	pthread_mutex_lock(&dispdevice_mutex);
+	if (dispdevice_path[0] == 0)
+		dispdevice_path_set();
+
+	if (dispdevice_path[0] != 0) {
+		sprintf(fname, "%s%s/%s", DISPDEVICE_PATH_1,
+				dispdevice_path, file);
+		fd = open(fname, attr);
+		/* A missing file means a changed device. Without uevents it
+		 * is the only sign, with uevents it covers lost ones.
+		 */
+		if ((fd < 0) && (errno == ENOENT))
+			dispdevice_path[0] = 0;
+	}
+	pthread_mutex_unlock(&dispdevice_mutex);
+	return fd;
+}
+
+/* Handle one uevent message. Returns 1 if it was for the display device. */
+static int dispdevice_uevent_handle(char *msg, int len)
+{
+	char *devpath;
+	char *name;
+	int changed = 0;
+
+	msg[len] = 0;
+	devpath = strchr(msg, '@');
+	if (devpath == NULL)
+		return 0;
+	*devpath++ = 0;
+
+	/* Only the display device itself, not its children */
+	if (strncmp(devpath, "/devices/", 9))
+		return 0;
+	name = devpath + 9;
+	if (strncmp(name, DISPDEVICE_PATH_2, strlen(DISPDEVICE_PATH_2)) ||
+							strchr(name, '/'))
+		return 0;
+
+	LOGHDMILIB("%s %s %s", __func__, msg, name);
+
+	pthread_mutex_lock(&dispdevice_mutex);
+	if (strcmp(msg, "remove") == 0) {
+		dispdevice_path[0] = 0;
+		changed = 1;
+	} else if (strcmp(name, dispdevice_path)) {
+		if (snprintf(dispdevice_path, sizeof(dispdevice_path), "%s",
+				name) >= (int)sizeof(dispdevice_path))
+			dispdevice_path[0] = 0;
+		changed = 1;
+	}
+	pthread_mutex_unlock(&dispdevice_mutex);
+
+	if (changed)
+		/* Files of an old device must not be used */
+		sysfs_dispdevice_close();
+	return 1;
+}
+
+/* Handle pending uevents without blocking.
+ * Returns 1 if any was for the display device, or uevents were lost.
+ * Must not be called with a sysfs file in use.
+ */
+int dispdevice_uevent_check(void)
+{
+	char msg[UEVENT_MSG_MAX + 1];
+	int found = 0;
+	int len;
+
+	if (uevent_fd < 0)
+		return 0;
+
+	while (1) {
+		len = recv(uevent_fd, msg, UEVENT_MSG_MAX, MSG_DONTWAIT);
+		if (len > 0) {
+			found |= dispdevice_uevent_handle(msg, len);
+			continue;
+		}
+		if ((len < 0) && (errno == ENOBUFS)) {
+			/* Socket overflow, add or remove may be lost.
+			 * Rescan at next open.
+			 */
+			LOGHDMILIB("%s: uevents lost", __func__);
+			pthread_mutex_lock(&dispdevice_mutex);
+			dispdevice_path[0] = 0;
+			pthread_mutex_unlock(&dispdevice_mutex);
+			sysfs_dispdevice_close();
+			found = 1;
+			continue;
+		}
+		break;
+	}
+	return found;
+}
+
+/* Returns 1 if the display device directory exists */
+int dispdevice_present(void)
+{
+	int present;
+
+	pthread_mutex_lock(&dispdevice_mutex);
+	if (dispdevice_path[0] == 0)
+		dispdevice_path_set();
+	present = dispdevice_path[0] != 0;
+	pthread_mutex_unlock(&dispdevice_mutex);
+	return present;
+}
+
+/* Wait at most timeout ms for a uevent for the display device.
+ * Returns 0 if one was received.
+ */
+int dispdevice_wait(int timeout)
+{
+	struct pollfd pollfd;
+	long long deadline = hdmi_time_us() + timeout * 1000LL;
+	long long left;
+
+	if (uevent_fd < 0) {
+		/* No uevents, just let time pass */
+		usleep(timeout * 1000);
+		return -1;
+	}
+
+	pollfd.fd = uevent_fd;
+	pollfd.events = POLLIN;
+	while ((left = deadline - hdmi_time_us()) > 0) {
+		pollfd.revents = 0;
+		if (poll(&pollfd, 1, (int)((left + 999) / 1000)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (dispdevice_uevent_check())
+			return 0;
+	}
+	return -1;
+}
+
+/* Open uevent socket. Without it changes are only seen when files are
+ * missing.
+ */
+int dispdevice_init(void)
+{
+	struct sockaddr_nl addr;
+	int bufsize = UEVENT_BUF_SIZE;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0;
+	addr.nl_groups = 1;
+
+	uevent_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+						NETLINK_KOBJECT_UEVENT);
+	if (uevent_fd < 0) {
+		LOGHDMILIB("%s: no uevent socket %d", __func__, errno);
+		return -1;
+	}
+	setsockopt(uevent_fd, SOL_SOCKET, SO_RCVBUF, &bufsize,
+							sizeof(bufsize));
+	if (bind(uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		LOGHDMILIB("%s: uevent bind failed %d", __func__, errno);
+		close(uevent_fd);
+		uevent_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void dispdevice_exit(void)
+{
+	if (uevent_fd >= 0) {
+		close(uevent_fd);
+		uevent_fd = -1;
+	}
+	pthread_mutex_lock(&dispdevice_mutex);
+	dispdevice_path[0] = 0;
+	pthread_mutex_unlock(&dispdevice_mutex);
+}
@@ -45,8 +45,6 @@ struct edid_stdtim_ar {
 	int y;
 };
 
-const __u8 edidreqbl0[] = {0xA0, 0x00}; /* Request EDID block 0 */
-const __u8 edidreqbl1[] = {0xA0, 0x01}; /* Request EDID block 1 */
 const __u8 edid_block0_start[] = {
 			0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
 const __u8 edid_stdtim9_flag[] = {0x00, 0x00, 0x00, 0xFA, 0x00};
@@ -67,22 +65,8 @@ const struct edid_stdtim_ar edid_stdtim_ar[] = {
 		{16, 9}
 };
 
-struct vesa_modes {
-	int xres;
-	int yres;
-	int freq;
-	int vesa_nr;
-};
-
-static struct vesa_modes vesa_modes[] = {
-	{800, 600, 60, 9},
-	{848, 480, 60, 14},
-	{1024, 768, 60, 16},
-	{1280, 768, 60, 23},
-	{1280, 800, 60, 28},
-	{1360, 768, 60, 39},
-	{1366, 768, 60, 81}
-};
+/* DDC reads since last edid_ddc_stats_take */
+static struct edid_ddc_stats edid_ddc;
 
 static int get_vesanr_from_est_timing(int timing, int byte, int bit)
 {
@@ -156,84 +140,240 @@ static int get_vesanr_from_est_timing(int timing, int byte, int bit)
 	return vesa_nr;
 }
 
-int get_vesanr_from_std_timing(int xres, int yres, int freq)
-{
-	int vesa_nr = -1;
-	int nr_of_timings;
-	int index;
-
-	nr_of_timings = sizeof(vesa_modes)/sizeof(vesa_modes[0]);
-	for (index = 0; index < nr_of_timings; index++) {
-		if ((xres == vesa_modes[index].xres) &&
-				(yres == vesa_modes[index].yres) &&
-				(freq == vesa_modes[index].freq)) {
-			vesa_nr = vesa_modes[index].vesa_nr;
-			break;
-		}
-	}
-
-	return vesa_nr;
-}
-
-/* Request and read EDID message for specified block */
+/* Request and read EDID message for specified block.
+ * The request is the DDC address and the block within its E-DDC segment,
+ * followed by the segment pointer for blocks after the first segment.
+ * The sysfs file holds one leading byte followed by the EDID block.
+ * Returns number of bytes read, or negative value on failure.
+ */
 int edid_read(__u8 block, __u8 *data)
 {
-	int edidread;
 	int res;
 	int result = 0;
-	__u8 buf[16];
-	int size;
+	__u8 buf[3];
+	int size = 2;
 
 	LOGHDMILIB("EDID read blk %d", block);
-	/* Request edid block 0 */
-	edidread = open(EDIDREAD_FILE, O_RDWR);
-	if (edidread < 0) {
-		LOGHDMILIB("***** Failed to open %s *****", EDIDREAD_FILE);
-		result = -1;
-		goto edid_read_end2;
-	}
-
-	if (block == 0) {
-		size = sizeof(edidreqbl0);
-		memcpy(buf, edidreqbl0, size);
-	} else {
-		size = sizeof(edidreqbl1);
-		memcpy(buf, edidreqbl1, size);
-	}
+	buf[0] = EDID_DDC_ADDR;
+	buf[1] = block % EDID_SEGMENT_BLOCKS;
+	if (block >= EDID_SEGMENT_BLOCKS)
+		buf[size++] = block / EDID_SEGMENT_BLOCKS;
 
-	res = write(edidread, buf, size);
+	/* Request edid block */
+	res = sysfs_write(SYSFS_EDIDREAD, buf, size);
 	if (res < 0) {
 		LOGHDMILIB("***** Failed to write %s *****", EDIDREAD_FILE);
 		result = -2;
-		goto edid_read_end1;
+		goto edid_read_end;
 	}
 
 	/* Check edid response */
-	lseek(edidread, 0, SEEK_SET);
-	res = read(edidread, data, EDIDREAD_SIZE);
-	if (res != EDIDREAD_SIZE) {
+	res = sysfs_read(SYSFS_EDIDREAD, data, EDIDREAD_BUF_SIZE);
+	if (res < EDIDREAD_SIZE) {
 		LOGHDMILIB("***** %s read error size: %d *****", EDIDREAD_FILE,
 				res);
 		result = -3;
-		goto edid_read_end1;
+		goto edid_read_end;
 	}
+	result = res;
 
-edid_read_end1:
-	close(edidread);
-edid_read_end2:
+edid_read_end:
 	return result;
 }
 
-/* Parse EDID block 0 */
-int edid_parse0(__u8 *data, __u8 *extension, struct video_format formats[],
-			int nr_formats)
+/* Check that a read EDID block is complete.
+ * data points to the EDID block, size is the number of block bytes read.
+ * The checksum can only be checked if the whole block was read.
+ */
+int edid_block_check(__u8 block, __u8 *data, int size)
+{
+	__u8 sum = 0;
+	int index;
+
+	if ((block == 0) && (memcmp(data + EDID_BL0_HEADER_OFFSET,
+			edid_block0_start, sizeof(edid_block0_start)) != 0))
+		return EDIDREAD_FAIL;
+
+	if (size < EDID_BLOCK_SIZE)
+		return RESULT_OK;
+
+	for (index = 0; index < EDID_BLOCK_SIZE; index++)
+		sum += data[index];
+	if (sum != 0) {
+		LOGHDMILIB("EDID blk %d checksum error:%02x", block, sum);
+		return EDIDREAD_CHKSUM_FAIL;
+	}
+	return RESULT_OK;
+}
+
+/* Read EDID block until a complete block is read or deadline_us has
+ * passed. The wait between attempts starts at EDID_RETRY_MIN_US and is
+ * doubled up to EDID_RETRY_MAX_US, so a sink that is a bit slow only
+ * costs a little more than its own delay. The first checksum failure is
+ * read again without waiting. Reads and failures are counted in edid_ddc.
+ */
+int edid_acquire(__u8 block, __u8 *data, int deadline_us)
+{
+	long long start;
+	long long attempt_start;
+	long long now;
+	int wait = EDID_RETRY_MIN_US;
+	int attempt = 0;
+	int reread = 0;
+	int res;
+
+	start = hdmi_time_us();
+	while (1) {
+		attempt++;
+		attempt_start = hdmi_time_us();
+		edid_ddc.reads++;
+		res = edid_read(block, data);
+		if (res > 0) {
+			res = edid_block_check(block, data + 1, res - 1);
+			if (res == EDIDREAD_CHKSUM_FAIL)
+				edid_ddc.chksum_errors++;
+			else if (res)
+				edid_ddc.header_errors++;
+		} else {
+			edid_ddc.read_errors++;
+		}
+		now = hdmi_time_us();
+		LOGHDMILIB("EDID blk %d attempt %d res:%d %lldus", block,
+				attempt, res, now - attempt_start);
+		if (res == 0)
+			return RESULT_OK;
+
+		/* The sink answered, the data was corrupted on the way.
+		 * Read the block again at once.
+		 */
+		if ((res == EDIDREAD_CHKSUM_FAIL) && !reread) {
+			reread = 1;
+			continue;
+		}
+
+		if (now + wait - start > deadline_us) {
+			LOGHDMILIB("EDID blk %d failed after %lldus", block,
+					now - start);
+			return res;
+		}
+
+		usleep(wait);
+		wait *= 2;
+		if (wait > EDID_RETRY_MAX_US)
+			wait = EDID_RETRY_MAX_US;
+	}
+}
+
+/* Add the DDC reads since the last call to sum, if not NULL, and clear
+ * them. Returns the number of failed reads added.
+ */
+int edid_ddc_stats_take(struct edid_ddc_stats *sum)
+{
+	int errors = edid_ddc.read_errors + edid_ddc.header_errors +
+						edid_ddc.chksum_errors;
+
+	if (sum) {
+		sum->reads += edid_ddc.reads;
+		sum->read_errors += edid_ddc.read_errors;
+		sum->header_errors += edid_ddc.header_errors;
+		sum->chksum_errors += edid_ddc.chksum_errors;
+	}
+	memset(&edid_ddc, 0, sizeof(edid_ddc));
+	return errors;
+}
+
+/* Decode a Detailed Timing Descriptor. Returns -1 for other descriptors */
+static int edid_dtd(__u8 *p, struct video_timing *t)
+{
+	int pixclk;
+	int hblank;
+	int vblank;
+	int hmm;
+	int vmm;
+
+	pixclk = p[EDID_DTD_PIXCLK] | (p[EDID_DTD_PIXCLK + 1] << 8);
+	if (pixclk == 0)
+		return -1;
+
+	memset(t, 0, sizeof(*t));
+	t->xres = p[EDID_DTD_HACT] | ((p[EDID_DTD_HHIGH] & 0xF0) << 4);
+	hblank = p[EDID_DTD_HBLANK] | ((p[EDID_DTD_HHIGH] & 0x0F) << 8);
+	t->yres = p[EDID_DTD_VACT] | ((p[EDID_DTD_VHIGH] & 0xF0) << 4);
+	vblank = p[EDID_DTD_VBLANK] | ((p[EDID_DTD_VHIGH] & 0x0F) << 8);
+	t->hfp = p[EDID_DTD_HFP] | ((p[EDID_DTD_SYNC_HIGH] & 0xC0) << 2);
+	t->hsync = p[EDID_DTD_HSYNC] | ((p[EDID_DTD_SYNC_HIGH] & 0x30) << 4);
+	t->vfp = (p[EDID_DTD_VFP_VSYNC] >> 4) |
+				((p[EDID_DTD_SYNC_HIGH] & 0x0C) << 2);
+	t->vsync = (p[EDID_DTD_VFP_VSYNC] & 0x0F) |
+				((p[EDID_DTD_SYNC_HIGH] & 0x03) << 4);
+	if ((t->xres == 0) || (t->yres == 0) ||
+			(t->hfp + t->hsync > hblank) ||
+			(t->vfp + t->vsync > vblank))
+		return -1;
+	t->hbp = hblank - t->hfp - t->hsync;
+	t->vbp = vblank - t->vfp - t->vsync;
+	t->pixclock = 100000000 / pixclk;
+	t->refresh = pixclk * 10000 / ((t->xres + hblank) * (t->yres + vblank));
+
+	/* Vertical values of interlaced formats are per field */
+	if (p[EDID_DTD_FLAGS] & EDID_DTD_INTERLACED) {
+		t->flags |= TIMING_INTERLACED;
+		t->yres *= 2;
+	}
+
+	/* Aspect ratio from image size, to tell CEA formats apart */
+	hmm = p[EDID_DTD_HMM] | ((p[EDID_DTD_MM_HIGH] & 0xF0) << 4);
+	vmm = p[EDID_DTD_VMM] | ((p[EDID_DTD_MM_HIGH] & 0x0F) << 8);
+	if (hmm && vmm) {
+		if (hmm * 100 >= vmm * 200)
+			t->flags |= TIMING_AR_64_27;
+		else if (hmm * 100 >= vmm * 155)
+			t->flags |= TIMING_AR_16_9;
+		else if (hmm * 100 >= vmm * 125)
+			t->flags |= TIMING_AR_4_3;
+	}
+	return 0;
+}
+
+/*
+ * Decode the DTDs at data[offset] up to end and add their formats to sink.
+ * If preferred is set, the formats of the first DTD are the native ones.
+ */
+static void edid_dtds(__u8 *data, int offset, int end,
+		struct vesacea_set *sink, struct edid_caps *caps, int preferred)
+{
+	struct video_timing t;
+	struct vesacea_set formats;
+	int nr;
+
+	for (; offset + EDID_DTD_SIZE <= end; offset += EDID_DTD_SIZE) {
+		if (edid_dtd(data + offset, &t))
+			continue;
+
+		memset(&formats, 0, sizeof(formats));
+		nr = timing_match(&t, &formats);
+		LOGHDMILIB("DTD %dx%d%s@%d formats:%d", t.xres, t.yres,
+				(t.flags & TIMING_INTERLACED) ? "i" : "p",
+				t.refresh, nr);
+		caps->nr_dtds++;
+		vesacea_set_add_set(sink, &formats);
+		if (preferred && nr) {
+			caps->native = formats;
+			caps->native_dtd = 1;
+		}
+		preferred = 0;
+	}
+}
+
+/* Parse EDID block 0. Sets extension to the number of extension blocks */
+int edid_parse0(__u8 *data, __u8 *extension, struct vesacea_set *sink,
+		struct edid_caps *caps)
 {
 	__u8 version;
 	__u8 revision;
 	__u8 est_timing;
 	int vesa_nr;
 	int bit;
-	int cnt;
 	int index;
 	int xres;
 	int yres;
@@ -267,7 +407,7 @@ int edid_parse0(__u8 *data, __u8 *extension, struct video_format formats[],
 	revision = *(data + EDID_BL0_REVISION_OFFSET);
 	LOGHDMILIB("Ver:%d Rev:%d", version, revision);
 
-	/* Read Established Timings 1&2 and set sink_support */
+	/* Read Established Timings 1&2 and add them to sink */
 	for (index = 0; index <= 1; index++) {
 		est_timing = *(data + edid_esttim1_2_offset[index]);
 		LOGHDMILIB2("EstTim%d:%02x", index + 1, est_timing);
@@ -282,27 +422,14 @@ int edid_parse0(__u8 *data, __u8 *extension, struct video_format formats[],
 				if (vesa_nr < 1)
 					continue;
 
-				LOGHDMILIB2("EstTim1&2 try vesa_nr:%d",
-							vesa_nr);
-				for (cnt = 0; cnt < nr_formats; cnt++) {
-					LOGHDMILIB3("with:%d",
-							formats[cnt].vesaceanr);
-					if ((formats[cnt].cea == 0) &&
-						(formats[cnt].vesaceanr ==
-								vesa_nr)) {
-						formats[cnt].sink_support = 1;
-						LOGHDMILIB("EstTim1&2 %d "
-								"vesa_nr:%d",
-								index + 1,
-								vesa_nr);
-						break;
-					}
-				}
+				vesacea_set_add(sink, 0, vesa_nr);
+				LOGHDMILIB("EstTim1&2 %d vesa_nr:%d",
+						index + 1, vesa_nr);
 			}
 		}
 	}
 
-	/* Read Standard Timings 1-8 and set sink_support*/
+	/* Read Standard Timings 1-8 and add them to sink */
 	for (index = 0; index < EDID_BL0_STDTIM1_SIZE; index++) {
 		edidp = EDID_BL0_STDTIM1_OFFSET + index * 2;
 		xres = (*(data + edidp) + 31) * 8;
@@ -313,47 +440,34 @@ int edid_parse0(__u8 *data, __u8 *extension, struct video_format formats[],
 		freq = 60 + ((byte & EDID_STDTIM_FREQ_MASK) >>
 				EDID_STDTIM_FREQ_SHIFT);
 		LOGHDMILIB2("xres:%d yres:%d freq:%d", xres, yres, freq);
-		vesa_nr = get_vesanr_from_std_timing(xres, yres, freq);
+		vesa_nr = timing_dmt_find(xres, yres, freq);
 		if (vesa_nr < 1)
 			continue;
 
-		LOGHDMILIB2("StdTim1to8 try vesa_nr:%d", vesa_nr);
-		for (cnt = 0; cnt < nr_formats; cnt++) {
-			LOGHDMILIB3("with:%d",
-				formats[cnt].vesaceanr);
-			if ((formats[cnt].cea == 0) &&
-					(formats[cnt].vesaceanr ==
-							vesa_nr)) {
-				formats[cnt].sink_support = 1;
-				LOGHDMILIB("StdTim1to8 %d vesa_nr:%d",
-						index + 1,
-						vesa_nr);
-				break;
-			}
-		}
+		vesacea_set_add(sink, 0, vesa_nr);
+		LOGHDMILIB("StdTim1to8 %d vesa_nr:%d", index + 1, vesa_nr);
 	}
 
-	if (*(data + EDID_BL0_EXTFLAG_OFFSET) != 0)
-		*extension = 1;
+	/* Read Detailed Timing Descriptors, the first may be the native */
+	edid_dtds(data, EDID_BL0_DTD1_OFFSET,
+			EDID_BL0_DTD1_OFFSET + EDID_BL0_DTDS * EDID_DTD_SIZE,
+			sink, caps,
+			(revision >= EDID_REVISION_4) ||
+			(*(data + EDID_BL0_FEATURE_OFFSET) &
+						EDID_FEATURE_PREFERRED));
+
+	*extension = *(data + EDID_BL0_EXTFLAG_OFFSET);
 
 	return RESULT_OK;
 }
 
-/* Parse EDID block 1 */
-int edid_parse1(__u8 *data, struct video_format formats[], int nr_formats,
-		int *basic_audio_support, struct edid_latency *edid_latency,
-		int *hdmi)
+/* Read Established Timing 3 and Standard Timings 9-16 at the fixed
+ * descriptor offsets of an extension block and add them to sink.
+ */
+static void edid_parse_ext_timings(__u8 *data, struct vesacea_set *sink)
 {
-	__u8 tag;
-	__u8 rev;
-	__u8 offset;
-	__u8 blockp;
-	__u8 code;
-	__u8 length = 0;
-	__u8 ceanr;
 	int index;
 	int index2;
-	int cnt;
 	__u8 est_timing3;
 	int byte;
 	int bit;
@@ -363,98 +477,8 @@ int edid_parse1(__u8 *data, struct video_format formats[], int nr_formats,
 	int ar_index;
 	int freq;
 	__u8 edidp;
-	__u8 *p;
-
-	tag = *(data + EDID_BL1_TAG_OFFSET);
-	rev = *(data + EDID_BL1_REVNR_OFFSET);
-	if (tag != EDID_BL1_TAG_EXPECTED) {
-		LOGHDMILIB("edid bl1 tag:%02x or rev:%02x", tag, rev);
-		return EDIDREAD_BL1_TAG_REV_ERR;
-	}
-
-	if (rev >= EDID_EXTVER_3)
-		*hdmi = 1;
-	else
-		*hdmi = 0; /* Only DVI */
-
-	offset = *(data + EDID_BL1_OFFSET_OFFSET);
-
-	LOGHDMILIB("rev:%d offset:%d", rev, offset);
-
-	/* Check Audio support */
-	if (*(data + EDID_BL1_AUDIO_SUPPORT_OFFSET) &
-			EDID_BASIC_AUDIO_SUPPORT_MASK) {
-		*basic_audio_support = 1;
-	}
-
-	for (edidp = EDID_BLK_START; edidp < offset;
-				edidp = edidp + length + 1) {
-		code = (*(data + edidp) & EDID_BLK_CODE_MSK) >>
-						EDID_BLK_CODE_SHIFT;
-		length = *(data + edidp) & EDID_BLK_LENGTH_MSK;
-
-		if ((offset + length) >= EDIDREAD_SIZE)
-			return EDIDREAD_FAIL;
 
-		LOGHDMILIB2("code:%d blklen:%d", code, length);
-
-		switch (code) {
-		case EDID_CODE_VIDEO:
-			for (blockp = edidp + 1; blockp < edidp + 1 + length;
-							blockp++) {
-				ceanr = *(data + blockp) & EDID_SVD_ID_MASK;
-				LOGHDMILIB2("try ceanr:%d", ceanr);
-				for (cnt = 0; cnt < nr_formats; cnt++) {
-					LOGHDMILIB3("with:%d",
-							formats[cnt].vesaceanr);
-					if ((formats[cnt].cea == 1) &&
-						(formats[cnt].vesaceanr ==
-								ceanr)) {
-						formats[cnt].sink_support = 1;
-						LOGHDMILIB("cea:%d", ceanr);
-						break;
-					}
-				}
-			}
-			break;
-
-		case EDID_CODE_VSDB:
-			p = data + edidp;
-			if (length >= (EDID_VSD_PHYS_SRC + 1)) {
-				LOGHDMILIB("source physaddr:%02x%02x",
-					*(p + EDID_VSD_PHYS_SRC),
-					*(p + EDID_VSD_PHYS_SRC + 1));
-
-				/*TODO logical addr (HDMI spec p.192)*/
-			}
-
-			/* Video and Audio latency */
-			if ((length >= EDID_VSD_AUD_LAT) &&
-				(*(p + EDID_VSD_LATENCY_IND) &
-					EDID_VSD_LAT_FLD_MASK)) {
-				edid_latency->video_latency =
-				2 * (*(p + EDID_VSD_VID_LAT) - 1);
-				edid_latency->audio_latency =
-				2 * (*(p + EDID_VSD_AUD_LAT) - 1);
-			}
-
-			/* Interlaced Video and Audio latency */
-			if ((length >= EDID_VSD_INTLCD_AUD_LAT) &&
-				(*(p + EDID_VSD_LATENCY_IND) &
-					EDID_VSD_INTLCD_LAT_FLD_MASK)) {
-				edid_latency->intlcd_video_latency =
-				2 * (*(p + EDID_VSD_INTLCD_VID_LAT) - 1);
-				edid_latency->audio_latency =
-				2 * (*(p + EDID_VSD_INTLCD_AUD_LAT) - 1);
-			}
-			break;
-
-		default:
-			break;
-		}
-	}
-
-	/* Read Established Timing 3 and set sink_support */
+	/* Read Established Timing 3 and add it to sink */
 	for (index = 0; index <= 2; index++) {
 		edidp = edid_esttim3_flag_offset[index];
 
@@ -474,25 +498,16 @@ int edid_parse1(__u8 *data, struct video_format formats[], int nr_formats,
 
 				vesa_nr = get_vesanr_from_est_timing(3, byte,
 									bit);
-				/* Set sink_suuport */
-				LOGHDMILIB2("EstTim3 try vesa_nr:%d", vesa_nr);
-				for (cnt = 0; cnt < nr_formats; cnt++) {
-					LOGHDMILIB3("with:%d",
-							formats[cnt].vesaceanr);
-					if ((formats[cnt].cea == 0) &&
-						(formats[cnt].vesaceanr ==
-								vesa_nr)) {
-						formats[cnt].sink_support = 1;
-						LOGHDMILIB("EstTim3 vesa_nr:%d",
-								vesa_nr);
-						break;
-					}
-				}
+				if (vesa_nr < 1)
+					continue;
+
+				vesacea_set_add(sink, 0, vesa_nr);
+				LOGHDMILIB("EstTim3 vesa_nr:%d", vesa_nr);
 			}
 		}
 	}
 
-	/* Read Standard Timings 9-16 and set sink_support*/
+	/* Read Standard Timings 9-16 and add them to sink */
 	for (index2 = 0; index2 <= 2; index2++) {
 		edidp = edid_stdtim9_flag_offset[index2];
 
@@ -503,7 +518,8 @@ int edid_parse1(__u8 *data, struct video_format formats[], int nr_formats,
 			continue;
 
 		for (index = 0; index < EDID_BL1_STDTIM9_SIZE; index++) {
-			edidp += EDID_BL1_STDTIM9_BYTE_START + index * 2;
+			edidp = edid_stdtim9_flag_offset[index2] +
+				EDID_BL1_STDTIM9_BYTE_START + index * 2;
 			xres = (*(data + edidp) + 31) * 8;
 			byte = *(data + edidp + 1);
 			ar_index = (byte & EDID_STDTIM_AR_MASK) >>
@@ -514,41 +530,305 @@ int edid_parse1(__u8 *data, struct video_format formats[], int nr_formats,
 						EDID_STDTIM_FREQ_SHIFT);
 			LOGHDMILIB2("xres:%d yres:%d freq:%d", xres, yres,
 									freq);
-			vesa_nr = get_vesanr_from_std_timing(xres, yres, freq);
-			LOGHDMILIB2("StdTim9to16 try vesa_nr:%d", vesa_nr);
-			for (cnt = 0; cnt < nr_formats; cnt++) {
-				LOGHDMILIB3("with:%d",
-					formats[cnt].vesaceanr);
-				if ((formats[cnt].cea == 0) &&
-						(formats[cnt].vesaceanr ==
-								vesa_nr)) {
-					formats[cnt].sink_support = 1;
-					LOGHDMILIB("StdTim9to16 %d vesa_nr:%d",
-							index + 1,
-							vesa_nr);
-					break;
-				}
-			}
+			vesa_nr = timing_dmt_find(xres, yres, freq);
+			if (vesa_nr < 1)
+				continue;
+
+			vesacea_set_add(sink, 0, vesa_nr);
+			LOGHDMILIB("StdTim9to16 %d vesa_nr:%d", index + 1,
+								vesa_nr);
 		}
 	}
+}
+
+/*
+ * CEA-861 data block collection.
+ * Each data block is decoded by the handler of its tag code, or of its
+ * extended tag code for EDID_CODE_EXT, into the capabilities of the sink.
+ * Blocks without a handler are skipped. All CEA extension blocks are
+ * decoded into the same edid_caps, in order, so SVD indexes used by the
+ * YCbCr 4:2:0 capability map count SVDs of earlier blocks too.
+ */
+struct edid_ctx {
+	struct edid_caps *caps;
+	struct edid_latency *latency;
+	struct vesacea_set *sink;
+};
+
+struct edid_dblk {
+	__u8 code;
+	__u8 ext_code;		/* Extended tag code, EDID_CODE_EXT only */
+	void (*parse)(struct edid_ctx *ctx, __u8 *p, int len);
+};
+
+static __u32 edid_oui(__u8 *p)
+{
+	return p[1] | (p[2] << 8) | (p[3] << 16);
+}
+
+/* Short Audio Descriptors */
+static void edid_dblk_audio(struct edid_ctx *ctx, __u8 *p, int len)
+{
+	struct edid_caps *caps = ctx->caps;
+	int index;
+
+	for (index = 1; index + EDID_SAD_SIZE <= len + 1;
+						index += EDID_SAD_SIZE) {
+		if (caps->nr_sads >= EDID_SADS_MAX)
+			break;
+		memcpy(caps->sad[caps->nr_sads++], p + index, EDID_SAD_SIZE);
+	}
+}
+
+/* Short Video Descriptors */
+static void edid_dblk_video(struct edid_ctx *ctx, __u8 *p, int len)
+{
+	struct edid_caps *caps = ctx->caps;
+	__u8 svd;
+	__u8 ceanr;
+	int index;
+
+	for (index = 1; index <= len; index++) {
+		svd = p[index];
+		/* Native flag only in 129-192, other codes are the VIC */
+		if ((svd >= EDID_SVD_NATIVE_MIN) && (svd <= EDID_SVD_NATIVE_MAX))
+			ceanr = svd & EDID_SVD_ID_MASK;
+		else
+			ceanr = svd;
+		if (caps->nr_svds < EDID_SVDS_MAX)
+			caps->svd[caps->nr_svds++] = svd;
+
+		vesacea_set_add(ctx->sink, 1, ceanr);
+		LOGHDMILIB("cea:%d", ceanr);
+
+		/* Native SVDs unless the preferred DTD gave the native */
+		if ((svd >= EDID_SVD_NATIVE_MIN) &&
+				(svd <= EDID_SVD_NATIVE_MAX) &&
+				!caps->native_dtd)
+			vesacea_set_add(&caps->native, 1, ceanr);
+	}
+}
+
+/* HDMI Forum VSDB, or SCDB with the same payload */
+static void edid_hf(struct edid_ctx *ctx, __u8 *p, int len)
+{
+	struct edid_caps *caps = ctx->caps;
+
+	if (len < EDID_HF_FLAGS)
+		return;
+	caps->hf_version = p[EDID_HF_VERSION];
+	caps->hf_max_tmds = p[EDID_HF_MAX_TMDS];
+	caps->hf_flags = p[EDID_HF_FLAGS];
+	if (len >= EDID_HF_DC420)
+		caps->hf_dc420 = p[EDID_HF_DC420];
+}
+
+/* Vendor Specific Data Block, HDMI 1.x or HDMI Forum */
+static void edid_dblk_vsdb(struct edid_ctx *ctx, __u8 *p, int len)
+{
+	struct edid_caps *caps = ctx->caps;
+	struct edid_latency *edid_latency = ctx->latency;
+
+	if (len < EDID_VSD_OUI_END)
+		return;
+
+	if (edid_oui(p) == EDID_OUI_HDMI_FORUM) {
+		edid_hf(ctx, p, len);
+		return;
+	}
+	if (edid_oui(p) != EDID_OUI_HDMI)
+		return;
+
+	caps->hdmi_vsdb = 1;
+	if (len >= (EDID_VSD_PHYS_SRC + 1)) {
+		caps->phys_addr = (p[EDID_VSD_PHYS_SRC] << 8) |
+						p[EDID_VSD_PHYS_SRC + 1];
+		LOGHDMILIB("source physaddr:%04x", caps->phys_addr);
+
+		/*TODO logical addr (HDMI spec p.192)*/
+	}
+	if (len >= EDID_VSD_DEEPCOLOR)
+		caps->deep_color = p[EDID_VSD_DEEPCOLOR];
+	if (len >= EDID_VSD_MAX_TMDS)
+		caps->max_tmds = p[EDID_VSD_MAX_TMDS];
+
+	/* Video and Audio latency */
+	if ((len >= EDID_VSD_AUD_LAT) &&
+		(*(p + EDID_VSD_LATENCY_IND) &
+			EDID_VSD_LAT_FLD_MASK)) {
+		edid_latency->video_latency =
+		2 * (*(p + EDID_VSD_VID_LAT) - 1);
+		edid_latency->audio_latency =
+		2 * (*(p + EDID_VSD_AUD_LAT) - 1);
+	}
+
+	/* Interlaced Video and Audio latency */
+	if ((len >= EDID_VSD_INTLCD_AUD_LAT) &&
+		(*(p + EDID_VSD_LATENCY_IND) &
+			EDID_VSD_INTLCD_LAT_FLD_MASK)) {
+		edid_latency->intlcd_video_latency =
+		2 * (*(p + EDID_VSD_INTLCD_VID_LAT) - 1);
+		edid_latency->intlcd_audio_latency =
+		2 * (*(p + EDID_VSD_INTLCD_AUD_LAT) - 1);
+	}
+}
+
+/* Speaker Allocation */
+static void edid_dblk_speaker(struct edid_ctx *ctx, __u8 *p, int len)
+{
+	if (len >= 2)
+		ctx->caps->speaker = p[1] | (p[2] << 8);
+}
+
+/* Colorimetry, extended tag */
+static void edid_dblk_colorimetry(struct edid_ctx *ctx, __u8 *p, int len)
+{
+	if (len >= 3)
+		ctx->caps->colorimetry = p[2] | (p[3] << 8);
+}
+
+/* YCbCr 4:2:0 Video, extended tag. VICs only supported as 4:2:0 */
+static void edid_dblk_y420vdb(struct edid_ctx *ctx, __u8 *p, int len)
+{
+	struct edid_caps *caps = ctx->caps;
+	int index;
+
+	for (index = 2; index <= len; index++) {
+		if (caps->nr_y420 >= EDID_Y420_MAX)
+			break;
+		caps->y420[caps->nr_y420++] = p[index];
+	}
+}
+
+/* YCbCr 4:2:0 Capability Map, extended tag. Bit n is SVD n, no map
+ * means all SVDs.
+ */
+static void edid_dblk_y420cmdb(struct edid_ctx *ctx, __u8 *p, int len)
+{
+	struct edid_caps *caps = ctx->caps;
+	int index;
+
+	if (len == 1) {
+		memset(caps->y420_map, 0xFF, sizeof(caps->y420_map));
+		return;
+	}
+	for (index = 2; (index <= len) &&
+			(index - 2 < (int)sizeof(caps->y420_map)); index++)
+		caps->y420_map[index - 2] |= p[index];
+}
+
+/* HDMI Forum SCDB, extended tag and two reserved bytes in place of the
+ * OUI, otherwise as HF-VSDB
+ */
+static void edid_dblk_hf_scdb(struct edid_ctx *ctx, __u8 *p, int len)
+{
+	edid_hf(ctx, p, len);
+}
+
+static const struct edid_dblk edid_dblks[] = {
+	{EDID_CODE_AUDIO, 0, edid_dblk_audio},
+	{EDID_CODE_VIDEO, 0, edid_dblk_video},
+	{EDID_CODE_VSDB, 0, edid_dblk_vsdb},
+	{EDID_CODE_SPEAKER, 0, edid_dblk_speaker},
+	{EDID_CODE_EXT, EDID_EXT_COLORIMETRY, edid_dblk_colorimetry},
+	{EDID_CODE_EXT, EDID_EXT_Y420VDB, edid_dblk_y420vdb},
+	{EDID_CODE_EXT, EDID_EXT_Y420CMDB, edid_dblk_y420cmdb},
+	{EDID_CODE_EXT, EDID_EXT_HF_SCDB, edid_dblk_hf_scdb},
+};
+
+/* Parse EDID extension block. CEA-861 blocks are decoded into caps and
+ * add their formats to sink, other extensions are skipped.
+ */
+int edid_parse_ext(__u8 *data, struct vesacea_set *sink,
+		struct edid_caps *caps, struct edid_latency *edid_latency)
+{
+	struct edid_ctx ctx;
+	__u8 tag;
+	__u8 rev;
+	__u8 offset;
+	__u8 code;
+	__u8 ext_code;
+	__u8 length = 0;
+	__u8 edidp;
+	unsigned int index;
+
+	tag = *(data + EDID_BL1_TAG_OFFSET);
+	rev = *(data + EDID_BL1_REVNR_OFFSET);
+	if (tag != EDID_BL1_TAG_EXPECTED) {
+		LOGHDMILIB("edid ext tag:%02x rev:%02x skipped", tag, rev);
+		return RESULT_OK;
+	}
+
+	caps->nr_cea++;
+	if (rev >= EDID_EXTVER_3)
+		caps->hdmi = 1;
+
+	offset = *(data + EDID_BL1_OFFSET_OFFSET);
+	if (offset == 0)
+		/* No DTDs and no data blocks */
+		offset = EDID_BLK_START;
+	if (offset > EDID_CHKSUM_OFFSET)
+		return EDIDREAD_FAIL;
+
+	LOGHDMILIB("rev:%d offset:%d", rev, offset);
+
+	/* Basic audio and YCbCr support */
+	caps->cea_flags |= *(data + EDID_BL1_AUDIO_SUPPORT_OFFSET);
+
+	ctx.caps = caps;
+	ctx.latency = edid_latency;
+	ctx.sink = sink;
+
+	for (edidp = EDID_BLK_START; edidp < offset;
+				edidp = edidp + length + 1) {
+		code = (*(data + edidp) & EDID_BLK_CODE_MSK) >>
+						EDID_BLK_CODE_SHIFT;
+		length = *(data + edidp) & EDID_BLK_LENGTH_MSK;
+
+		if (edidp + 1 + length > offset)
+			return EDIDREAD_FAIL;
+
+		ext_code = 0;
+		if ((code == EDID_CODE_EXT) && length)
+			ext_code = *(data + edidp + 1);
+
+		LOGHDMILIB2("code:%d ext:%d blklen:%d", code, ext_code,
+								length);
+
+		for (index = 0; index < ARRAY_SIZE(edid_dblks); index++)
+			if ((edid_dblks[index].code == code) &&
+				(edid_dblks[index].ext_code == ext_code)) {
+				edid_dblks[index].parse(&ctx, data + edidp,
+								length);
+				break;
+			}
+	}
+
+	if (*(data + EDID_BL1_OFFSET_OFFSET))
+		edid_dtds(data, offset, EDID_CHKSUM_OFFSET, sink, caps, 0);
+	edid_parse_ext_timings(data, sink);
 
 	return RESULT_OK;
 }
 
-/* Get EDID message of specified block and send it on client socket */
+/* Get EDID message of specified block and send it on client socket.
+ * Returns 0 if the block was read, as the result of the command.
+ */
 int edidreq(__u8 block, __u32 cmd_id)
 {
 	int res = 0;
-	int ret = 0;
 	int edidsize = 0;
 	int val;
 	__u8 buf[512];
-	__u8 ediddata[EDIDREAD_SIZE];
+	__u8 ediddata[EDIDREAD_BUF_SIZE];
 
 	LOGHDMILIB("%s begin", __func__);
 
-	/* Request EDID */
-	res = edid_read(block, ediddata);
+	/* Request EDID, only a block with a valid checksum is returned */
+	if (block < EDID_BLOCKS_MAX)
+		res = edid_acquire(block, ediddata, EDIDREAD_DEADLINE1);
+	else
+		res = EDIDREAD_FAIL;
 	if (res == 0)
 		edidsize = EDIDREAD_SIZE;
 
@@ -557,12 +837,15 @@ int edidreq(__u8 block, __u32 cmd_id)
 	memcpy(&buf[CMDID_OFFSET], &cmd_id, 4);
 	val = edidsize + 1;
 	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	buf[CMDBUF_OFFSET] = res;
-	memcpy(&buf[CMDBUF_OFFSET + 1], ediddata, edidsize);
+	/* 0 = ok, 1 = not ok. HDMI_CMDDONE has the error code */
+	buf[CMDBUF_OFFSET] = res ? 1 : 0;
+	/* Block follows the leading sysfs byte */
+	memcpy(&buf[CMDBUF_OFFSET + 1], ediddata + 1, edidsize);
 
-	/* Send on socket */
-	ret = clientsocket_send(buf, CMDBUF_OFFSET + val);
+	/* Send on socket. Send errors of subscribers are not the result */
+	if (clientsocket_send(buf, CMDBUF_OFFSET + val) < 0)
+		LOGHDMILIB("%s: send failed", __func__);
 
-	LOGHDMILIB("%s end", __func__);
-	return ret;
+	LOGHDMILIB("%s end:%d", __func__, res);
+	return res;
 }
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * Author: Per Persson per.xb.persson@stericsson.com for
+ * ST-Ericsson.
+ *
+ * License terms:
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <unistd.h>     /* Symbolic Constants */
+#include <sys/types.h>  /* Primitive System Data Types */
+#include <linux/types.h>
+#include <errno.h>      /* Errors */
+#include <stdarg.h>
+#include <stdio.h>      /* Input/Output */
+#include <stdlib.h>     /* General Utilities */
+#include <string.h>     /* String handling */
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#ifdef ANDROID
+#include <utils/Log.h>
+#endif
+#include "../include/hdmi_service_api.h"
+#include "../include/hdmi_service_local.h"
+
+/*
+ * Shared memory event ring, one per client that asks for it.
+ * The client creates a memfd with a struct hdmi_event_ring header and
+ * size bytes of data, and an eventfd, and passes both to the service with
+ * HDMI_EVENTRING. The service then writes messages for the client once,
+ * in wire format, to the ring instead of its socket, and the client
+ * reads them in place.
+ * head is only written by the service and tail only by the client, both
+ * are free running byte counts. Records start 4 byte aligned, a record
+ * that does not fit before the end of the data is preceded by a
+ * HDMI_EVENT_RING_PAD word and starts at offset 0. The eventfd is only
+ * written when the client has set waiting, so a busy client costs no
+ * system calls.
+ * The service never trusts the ring: tail is range checked and nothing
+ * but tail and waiting is read from it.
+ */
+struct eventring {
+	struct hdmi_event_ring *ring;
+	size_t map_size;	/* Mapped length, st_size of the memfd */
+	__u8 *data;
+	__u32 size;
+	__u32 head;	/* Private copy, ring->head is only written */
+	int evfd;
+	unsigned int drops;
+};
+
+#define EVENTRING_ALIGN(x) (((x) + 3) & ~3)
+
+/* memfd seals, not defined without _GNU_SOURCE */
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS		1033
+#define F_GET_SEALS		1034
+#define F_SEAL_SHRINK		0x0002
+#define F_SEAL_GROW		0x0004
+#endif
+#define EVENTRING_MFD_FLAGS	0x0003	/* MFD_CLOEXEC | MFD_ALLOW_SEALING */
+#define EVENTRING_SEALS		(F_SEAL_SHRINK | F_SEAL_GROW)
+
+static int eventring_size_ok(__u32 size)
+{
+	return (size >= EVENTRING_SIZE_MIN) && (size <= EVENTRING_SIZE_MAX) &&
+						!(size & (size - 1));
+}
+
+/* Service side. Map ring of client. memfd can be closed afterwards,
+ * evfd is duplicated. memfd must be sealed against resizing, or the
+ * client could truncate it under the mapping. Returns the ring or NULL.
+ */
+struct eventring *eventring_attach(int memfd, int evfd)
+{
+	struct eventring *er;
+	struct hdmi_event_ring *ring;
+	struct stat st;
+	__u32 size;
+	int seals;
+
+	seals = fcntl(memfd, F_GET_SEALS);
+	if ((seals < 0) || ((seals & EVENTRING_SEALS) != EVENTRING_SEALS)) {
+		LOGHDMILIB("%s memfd not sealed:%d", __func__, seals);
+		return NULL;
+	}
+
+	if ((fstat(memfd, &st) < 0) ||
+			(st.st_size < (off_t)sizeof(struct hdmi_event_ring)))
+		return NULL;
+
+	ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+							memfd, 0);
+	if (ring == MAP_FAILED) {
+		LOGHDMILIB("%s mmap fail:%d", __func__, errno);
+		return NULL;
+	}
+
+	/* Read once, the client may change it */
+	size = __atomic_load_n(&ring->size, __ATOMIC_RELAXED);
+	if ((ring->magic != HDMI_EVENT_RING_MAGIC) || !eventring_size_ok(size) ||
+		(sizeof(struct hdmi_event_ring) + size > (size_t)st.st_size)) {
+		LOGHDMILIB("%s bad ring size:%u", __func__, size);
+		munmap(ring, st.st_size);
+		return NULL;
+	}
+
+	er = malloc(sizeof(*er));
+	if (er == NULL) {
+		munmap(ring, st.st_size);
+		return NULL;
+	}
+	er->evfd = fcntl(evfd, F_DUPFD_CLOEXEC, 0);
+	if (er->evfd < 0) {
+		munmap(ring, st.st_size);
+		free(er);
+		return NULL;
+	}
+	er->ring = ring;
+	er->map_size = st.st_size;
+	er->data = (__u8 *)(ring + 1);
+	er->size = size;
+	er->head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	er->drops = 0;
+	return er;
+}
+
+void eventring_detach(struct eventring *er)
+{
+	if (er == NULL)
+		return;
+	LOGHDMILIB("%s drops:%u", __func__, er->drops);
+	munmap(er->ring, er->map_size);
+	close(er->evfd);
+	free(er);
+}
+
+/* Service side. Write message to ring and wake the client if it waits.
+ * Returns 0, or -1 if the ring is full and the message was dropped.
+ */
+int eventring_put(struct eventring *er, __u8 *buf, int len)
+{
+	struct hdmi_event_ring *ring = er->ring;
+	__u32 rec = EVENTRING_ALIGN(len);
+	__u32 pos = er->head & (er->size - 1);
+	__u32 pad = 0;
+	__u32 used;
+	__u32 val;
+	__u64 one = 1;
+
+	if (er->size - pos < rec)
+		pad = er->size - pos;
+
+	used = er->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if ((used > er->size) || (er->size - used < pad + rec)) {
+		/* Full, or tail is garbage */
+		er->drops++;
+		__atomic_store_n(&ring->drops, er->drops, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	if (pad) {
+		val = HDMI_EVENT_RING_PAD;
+		memcpy(er->data + pos, &val, 4);
+		pos = 0;
+	}
+	memcpy(er->data + pos, buf, len);
+	er->head += pad + rec;
+
+	/* Ordered against the load of waiting, see eventring_wait */
+	__atomic_store_n(&ring->head, er->head, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST) &&
+			__atomic_exchange_n(&ring->waiting, 0, __ATOMIC_SEQ_CST))
+		if (write(er->evfd, &one, sizeof(one)) < 0)
+			LOGHDMILIB("%s wake fail:%d", __func__, errno);
+	return 0;
+}
+
+/* Client side. Create ring with size bytes of data. Returns the mapped
+ * ring and sets memfd and evfd, or returns NULL.
+ */
+struct hdmi_event_ring *eventring_create(__u32 size, int *memfd, int *evfd)
+{
+	struct hdmi_event_ring *ring;
+	size_t total = sizeof(struct hdmi_event_ring) + size;
+
+	if (!eventring_size_ok(size))
+		return NULL;
+
+	*memfd = syscall(SYS_memfd_create, "hdmi_event_ring",
+						EVENTRING_MFD_FLAGS);
+	if (*memfd < 0) {
+		LOGHDMILIB("%s memfd fail:%d", __func__, errno);
+		return NULL;
+	}
+	if ((ftruncate(*memfd, total) < 0) ||
+			(fcntl(*memfd, F_ADD_SEALS, EVENTRING_SEALS) < 0))
+		goto eventring_create_err;
+	ring = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, *memfd,
+									0);
+	if (ring == MAP_FAILED)
+		goto eventring_create_err;
+	*evfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (*evfd < 0) {
+		munmap(ring, total);
+		goto eventring_create_err;
+	}
+
+	ring->magic = HDMI_EVENT_RING_MAGIC;
+	ring->size = size;
+	return ring;
+
+eventring_create_err:
+	LOGHDMILIB("%s fail:%d", __func__, errno);
+	close(*memfd);
+	*memfd = -1;
+	return NULL;
+}
+
+void eventring_destroy(struct hdmi_event_ring *ring)
+{
+	munmap(ring, sizeof(struct hdmi_event_ring) + ring->size);
+}
+
+/* Client side. Get next message in place. Returns 1 and sets the
+ * arguments, or 0 if the ring is empty.
+ */
+int eventring_read(struct hdmi_event_ring *ring, __u32 *cmd, __u32 *cmd_id,
+					__u32 *len, __u8 **data)
+{
+	__u8 *base = (__u8 *)(ring + 1);
+	__u32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	__u32 tail = ring->tail;
+	__u32 pos;
+	__u32 val;
+
+	if (head == tail)
+		return 0;
+
+	pos = tail & (ring->size - 1);
+	memcpy(&val, base + pos, 4);
+	if (val == HDMI_EVENT_RING_PAD) {
+		/* Record is at start of data */
+		tail += ring->size - pos;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		if (head == tail)
+			return 0;
+		pos = 0;
+	}
+
+	memcpy(cmd, base + pos + CMD_OFFSET, 4);
+	memcpy(cmd_id, base + pos + CMDID_OFFSET, 4);
+	memcpy(len, base + pos + CMDLEN_OFFSET, 4);
+	*data = base + pos + CMDBUF_OFFSET;
+	return 1;
+}
+
+/* Client side. Release message returned by eventring_read */
+void eventring_release(struct hdmi_event_ring *ring)
+{
+	__u8 *base = (__u8 *)(ring + 1);
+	__u32 pos = ring->tail & (ring->size - 1);
+	__u32 len;
+
+	memcpy(&len, base + pos + CMDLEN_OFFSET, 4);
+	__atomic_store_n(&ring->tail,
+			ring->tail + EVENTRING_ALIGN(CMDBUF_OFFSET + len),
+			__ATOMIC_RELEASE);
+}
+
+/* Client side. Wait at most timeout_ms for a message.
+ * Returns 1 if there is a message, 0 at timeout.
+ */
+int eventring_wait(struct hdmi_event_ring *ring, int evfd, int timeout_ms)
+{
+	struct pollfd pollfd;
+	__u64 val;
+	int res;
+
+	__atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail) {
+		__atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	pollfd.fd = evfd;
+	pollfd.events = POLLIN;
+	pollfd.revents = 0;
+	res = poll(&pollfd, 1, timeout_ms);
+	if ((res > 0) && (read(evfd, &val, sizeof(val)) < 0))
+		LOGHDMILIB("%s read fail:%d", __func__, errno);
+	__atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail;
+}
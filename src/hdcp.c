@@ -109,33 +109,146 @@ static char *dbg_hdcpstate(int value)
 	case HDCP_STATE_ENCR_ONGOING:
 		return "HDCP STATE ENCR_ONGOING";
 		break;
+	case HDCP_STATE_AES_LOADING:
+		return "HDCP STATE AES_LOADING";
+		break;
+	case HDCP_STATE_AES_OK:
+		return "HDCP STATE AES_OK";
+		break;
+	case HDCP_STATE_AES_FAIL:
+		return "HDCP STATE AES_FAIL";
+		break;
+	case HDCP_STATE_OTP_UNPROGGED:
+		return "HDCP STATE OTP_UNPROGGED";
+		break;
 	default:
 		return "HDCP STATE UNKNOWN";
 		break;
 	}
 }
 
-/* Load aes keys and start hdcp encryption */
+/*
+ * HDCP bring-up state machine.
+ * hdcp_init checks OTP and writes the AES keys. The remaining steps are
+ * run from hdcp_timer when the wait time of the current step has expired,
+ * or from hdcp_state when the kernel signals a HDCP event, so the main
+ * thread never sleeps during HDCP bring-up.
+ */
+enum hdcp_init_state {
+	HDCP_INIT_IDLE,
+	HDCP_INIT_LOADAES,	/* AES keys written, waiting for result */
+	HDCP_INIT_VERIFIED,	/* AES keys ok, waiting to start encryption */
+	HDCP_INIT_AUTH		/* Authentication and encryption started */
+};
+
+static enum hdcp_init_state hdcp_init_state = HDCP_INIT_IDLE;
+static long long hdcp_deadline;
+/* HDMI_HDCP_INIT command, reported when bring-up has ended */
+static struct cmd_done hdcp_cmd_done;
+static int hdcp_cmd_pending;
+
+/* Send HDMI_HDCPSTATE message on client socket */
+static int hdcp_state_send(__u8 state)
+{
+	__u8 buf[16];
+	int val;
+	__u32 cmd_id;
+
+	LOGHDMILIB("%s", dbg_hdcpstate(state));
+
+	cmd_id = get_new_cmd_id_ind();
+
+	val = HDMI_HDCPSTATE;
+	memcpy(&buf[CMD_OFFSET], &val, 4);
+	memcpy(&buf[CMDID_OFFSET], &cmd_id, 4);
+	val = 1;
+	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
+	buf[CMDBUF_OFFSET] = state;
+
+	/* Send on socket */
+	return clientsocket_send(buf, CMDBUF_OFFSET + val);
+}
+
+static void hdcp_init_state_set(enum hdcp_init_state state, int wait_us)
+{
+	hdcp_init_state = state;
+	if (wait_us)
+		hdcp_deadline = hdmi_time_us() + wait_us;
+	else
+		hdcp_deadline = 0;
+}
+
+/* Report end of bring-up for the HDMI_HDCP_INIT command that started it */
+static void hdcp_done(int result)
+{
+	if (!hdcp_cmd_pending)
+		return;
+	hdcp_cmd_pending = 0;
+	cmd_done_send(&hdcp_cmd_done, result);
+}
+
+/* Keep HDMI_HDCP_INIT command until bring-up has ended.
+ * Returns 0 if bring-up is not ongoing; the command is then done.
+ */
+int hdcp_done_defer(struct cmd_done *done)
+{
+	if (hdcp_init_state == HDCP_INIT_IDLE)
+		return 0;
+	hdcp_cmd_done = *done;
+	hdcp_cmd_pending = 1;
+	return 1;
+}
+
+/* Check AES keys load result */
+static int hdcp_loadaes_check(void)
+{
+	int res;
+	int value;
+	char buf[128];
+
+	res = sysfs_read(SYSFS_HDCPLOADAES, buf, sizeof(buf));
+	if (res != 1) {
+		LOGHDMILIB("***** %s read error *****",
+					HDCPLOADAES_FILE);
+		return SYSFS_FILE_FAILED;
+	}
+	value = *buf;
+	LOGHDMILIB("%s", dbg_loadaes(value));
+	if (value != LOADAES_OK)
+		return AESKEYS_FAIL;
+
+	LOGHDMILIB("%s", "--- LOAD AES keys OK ---");
+	return HDCP_OK;
+}
+
+/* Start HDCP encryption */
+static int hdcp_authencr_start(void)
+{
+	int res;
+
+	res = sysfs_write(SYSFS_HDCPAUTH, hdcp_encr_start_val,
+			sizeof(hdcp_encr_start_val));
+	if (res != sizeof(hdcp_encr_start_val)) {
+		LOGHDMILIB("***** Failed to write hdcpauthencr %d "
+				"*****", res);
+		return HDCPAUTHENCR_FAIL;
+	}
+	return HDCP_OK;
+}
+
+/* Check OTP, load aes keys and start hdcp bring-up */
 int hdcp_init(__u8 *aes)
 {
-	int hdcpchkaesotp;
-	int hdcploadaes;
-	int hdcpauthencr;
-	int hdcpeven;
 	int res;
 	int value = 0;
 	char buf[128];
 	int result = HDCP_OK;
 
+	hdcp_done(HDCP_ABORTED);
+	hdcp_init_state_set(HDCP_INIT_IDLE, 0);
+
 	/* Check if OTP is fused */
-	hdcpchkaesotp = open(HDCPCHKAESOTP_FILE, O_RDONLY);
-	if (hdcpchkaesotp < 0) {
-		LOGHDMILIB("***** Failed to open %s *****", HDCPCHKAESOTP_FILE);
-		result = SYSFS_FILE_FAILED;
-		goto hdcp_end;
-	}
-	res = read(hdcpchkaesotp, buf, sizeof(buf));
-	close(hdcpchkaesotp);
+	res = sysfs_read(SYSFS_HDCPCHKAESOTP, buf, sizeof(buf));
 	if (res != 1) {
 		LOGHDMILIB("***** %s read error *****", HDCPCHKAESOTP_FILE);
 		result = SYSFS_FILE_FAILED;
@@ -146,30 +259,15 @@ int hdcp_init(__u8 *aes)
 
 	if (value == OTP_PROGGED) {
 		/* Subscribe for hdcp events */
-		hdcpeven = open(HDCPEVEN_FILE, O_WRONLY);
-		if (hdcpeven < 0) {
-			LOGHDMILIB("***** Failed to open %s *****",
-					HDCPEVEN_FILE);
-			result = SYSFS_FILE_FAILED;
-			goto hdcp_end;
-		}
-		res = write(hdcpeven, hdcp_even_val, sizeof(hdcp_even_val));
-		close(hdcpeven);
+		res = sysfs_write(SYSFS_HDCPEVEN, hdcp_even_val,
+						sizeof(hdcp_even_val));
 		if (res != sizeof(hdcp_even_val)) {
 			result = SYSFS_FILE_FAILED;
 			goto hdcp_end;
 		}
 
 		/* Write aes keys */
-		hdcploadaes = open(HDCPLOADAES_FILE, O_WRONLY);
-		if (hdcploadaes < 0) {
-			LOGHDMILIB("***** Failed to open %s *****",
-					HDCPLOADAES_FILE);
-			result = SYSFS_FILE_FAILED;
-			goto hdcp_end;
-		}
-		res = write(hdcploadaes, aes, AES_KEYS_SIZE);
-		close(hdcploadaes);
+		res = sysfs_write(SYSFS_HDCPLOADAES, aes, AES_KEYS_SIZE);
 		if (res != AES_KEYS_SIZE) {
 			LOGHDMILIB("***** Failed to write hdcploadaes %d "
 					"*****", res);
@@ -177,85 +275,99 @@ int hdcp_init(__u8 *aes)
 			goto hdcp_end;
 		}
 
-		usleep(LOADAES_WAITTIME);
+		/* Result is checked in hdcp_timer */
+		hdcp_init_state_set(HDCP_INIT_LOADAES, LOADAES_WAITTIME);
+		hdcp_state_send(HDCP_STATE_AES_LOADING);
+	} else {
+		printf("***** Missing aes file or HDCP AES OTP is not fused."
+				" *****\n");
+		hdcp_state_send(HDCP_STATE_OTP_UNPROGGED);
+		result = AESKEYS_FAIL;
+	}
 
-		/* Check result */
-		hdcploadaes = open(HDCPLOADAES_FILE, O_RDONLY);
-		if (hdcploadaes < 0) {
-			LOGHDMILIB("***** Failed to open %s *****",
-					HDCPLOADAES_FILE);
-			result = SYSFS_FILE_FAILED;
-			goto hdcp_end;
-		}
-		res = read(hdcploadaes, buf, sizeof(buf));
-		close(hdcploadaes);
-		if (res != 1) {
-			LOGHDMILIB("***** %s read error *****",
-						HDCPLOADAES_FILE);
-			result = SYSFS_FILE_FAILED;
-			goto hdcp_end;
-		}
-		value = *buf;
-		LOGHDMILIB("%s", dbg_loadaes(value));
-		if (value == LOADAES_OK) {
-			LOGHDMILIB("%s", "--- LOAD AES keys OK ---");
-		} else {
-			result = AESKEYS_FAIL;
-			goto hdcp_end;
-		}
+hdcp_end:
+	return result;
+}
 
-		usleep(LOADAES_WAITTIME);
+/* Stop an ongoing hdcp bring-up, e.g. at unplug */
+void hdcp_abort(void)
+{
+	if (hdcp_init_state != HDCP_INIT_IDLE)
+		LOGHDMILIB("%s state:%d", __func__, hdcp_init_state);
+	hdcp_init_state_set(HDCP_INIT_IDLE, 0);
+	hdcp_done(HDCP_ABORTED);
+}
 
-		/* Start HDCP encryption */
-		hdcpauthencr = open(HDCPAUTH_FILE, O_WRONLY);
-		if (hdcpauthencr < 0) {
-			LOGHDMILIB("***** Failed to open %s *****",
-					HDCPAUTH_FILE);
-			result = HDCPAUTHENCR_FAIL;
-			goto hdcp_end;
+/* Time in ms until hdcp_timer needs to be called, -1 if not needed */
+int hdcp_timeout_get(void)
+{
+	long long left;
+
+	if (hdcp_deadline == 0)
+		return -1;
+
+	left = hdcp_deadline - hdmi_time_us();
+	if (left <= 0)
+		return 0;
+	return (int)((left + 999) / 1000);
+}
+
+/* Run next hdcp bring-up step if its wait time has expired */
+int hdcp_timer(void)
+{
+	int result = HDCP_OK;
+
+	if ((hdcp_deadline == 0) || (hdmi_time_us() < hdcp_deadline))
+		return HDCP_OK;
+
+	LOGHDMILIB("%s state:%d", __func__, hdcp_init_state);
+
+	switch (hdcp_init_state) {
+	case HDCP_INIT_LOADAES:
+		result = hdcp_loadaes_check();
+		if (result != HDCP_OK) {
+			hdcp_init_state_set(HDCP_INIT_IDLE, 0);
+			hdcp_state_send(HDCP_STATE_AES_FAIL);
+			hdcp_done(result);
+			break;
 		}
-		res = write(hdcpauthencr, hdcp_encr_start_val,
-				sizeof(hdcp_encr_start_val));
-		close(hdcpauthencr);
-		if (res != sizeof(hdcp_encr_start_val)) {
-			LOGHDMILIB("***** Failed to write hdcpauthencr %d "
-					"*****", res);
-			result = HDCPAUTHENCR_FAIL;
-			goto hdcp_end;
+		hdcp_init_state_set(HDCP_INIT_VERIFIED, LOADAES_WAITTIME);
+		hdcp_state_send(HDCP_STATE_AES_OK);
+		break;
+
+	case HDCP_INIT_VERIFIED:
+		result = hdcp_authencr_start();
+		if (result != HDCP_OK) {
+			hdcp_init_state_set(HDCP_INIT_IDLE, 0);
+			hdcp_state_send(HDCP_STATE_AUTH_FAIL);
+			hdcp_done(result);
+			break;
 		}
-		usleep(HDCPAUTH_WAITTIME);
+		/* Done at HDCP event or when wait time expires */
+		hdcp_init_state_set(HDCP_INIT_AUTH, HDCPAUTH_WAITTIME);
+		hdcp_state_send(HDCP_STATE_AUTH_ONGOING);
+		break;
 
-	} else {
-		printf("***** Missing aes file or HDCP AES OTP is not fused."
-				" *****\n");
+	case HDCP_INIT_AUTH:
+	default:
+		LOGHDMILIB("%s", "HDCP bring-up done");
+		hdcp_init_state_set(HDCP_INIT_IDLE, 0);
+		hdcp_done(HDCP_OK);
+		break;
 	}
 
-hdcp_end:
 	return result;
 }
 
 /* Get current hdcp state */
 int hdcp_state(void)
 {
-	int hdcpstateget;
 	int result = HDCP_OK;
 	int res;
 	__u8 buf[128];
-	int val;
-	__u32 cmd_id;
-
-	cmd_id = get_new_cmd_id_ind();
 
 	/* Check hdcpstate */
-	hdcpstateget = open(HDCPSTATEGET_FILE, O_RDONLY);
-	if (hdcpstateget < 0) {
-		LOGHDMILIB("***** Failed to open %s *****",
-				HDCPSTATEGET_FILE);
-		result = SYSFS_FILE_FAILED;
-		goto hdcp_state_end;
-	}
-	res = read(hdcpstateget, buf, sizeof(buf));
-	close(hdcpstateget);
+	res = sysfs_read(SYSFS_HDCPSTATEGET, buf, sizeof(buf));
 	if (res != 1) {
 		LOGHDMILIB("***** %s read error *****",
 				HDCPSTATEGET_FILE);
@@ -263,18 +375,19 @@ int hdcp_state(void)
 		goto hdcp_state_end;
 	}
 
-	val = HDMI_HDCPSTATE;
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	memcpy(&buf[CMDID_OFFSET], &cmd_id, 4);
-	val = 1;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	memcpy(&buf[CMDBUF_OFFSET], buf, val);
-
 	/* Send on socket */
-	if (clientsocket_send(buf, CMDBUF_OFFSET + val) != 0)
+	if (hdcp_state_send(buf[0]) != 0)
 		result = HDCPSTATE_FAIL;
 
-	LOGHDMILIB("%s", dbg_hdcpstate(val));
+	/* Authentication result ends bring-up */
+	if ((hdcp_init_state == HDCP_INIT_AUTH) &&
+			((buf[0] == HDCP_STATE_AUTH_SUCCEDED) ||
+			(buf[0] == HDCP_STATE_ENCR_ONGOING) ||
+			(buf[0] == HDCP_STATE_AUTH_FAIL))) {
+		hdcp_init_state_set(HDCP_INIT_IDLE, 0);
+		hdcp_done(buf[0] == HDCP_STATE_AUTH_FAIL ? HDCPAUTH_FAIL :
+								HDCP_OK);
+	}
 
 hdcp_state_end:
 	return result;
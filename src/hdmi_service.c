@@ -38,98 +38,73 @@
 #include <sys/ioctl.h>
 #include "linux/fb.h"
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <stddef.h>
 #ifdef ANDROID
 #include <utils/Log.h>
 #endif
-#include <dirent.h>
 #include "../include/hdmi_service_api.h"
 #include "../include/hdmi_service_local.h"
 
 pthread_t thread_main;
-pthread_t thread_kevent;
 pthread_t thread_socklisten;
+pthread_mutex_t ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+int service_ready;
 pthread_mutex_t event_mutex;
 pthread_mutex_t fb_state_mutex;
-pthread_mutex_t cmd_mutex;
 pthread_cond_t event_cond;
-#ifdef HDMI_SERVICE_USE_CALLBACK_FN
-void (*hdmi_callback_fn)(int cmd, int data_length, __u8 *data) = NULL;
-#endif /*HDMI_SERVICE_USE_CALLBACK_FN*/
-int hdmi_events;
+/* Event journal. Events are handled in the order they were signalled */
+static struct hdmi_event_rec event_journal[EVENT_JOURNAL_SIZE];
+static unsigned int event_head;	/* seq of next event to add */
+static unsigned int event_tail;	/* seq of next event to handle */
+static int event_pending;	/* Coalesced events not in journal */
+static unsigned int event_coalesced;
+static unsigned int event_dropped;
 enum hdmi_fb_state hdmi_fb_state;
 enum hdmi_plug_state hdmi_plug_state = HDMI_PLUGUNDEF;
-struct cmd_data *cmd_data;
-int cmd_id_ind;
-char dispdevice_path[64];
+/* Profile of plugged sink, verified against EDID after plug if stored */
+static struct sink_profile plug_profile;
+static int plug_verify_pending;
+/* Profile of plugged sink to store from timer, after the plug event or
+ * command completion is sent
+ */
+static int plug_store_pending;
+static int plug_profile_valid;	/* Plug handled, profile in use */
+/* Command queue. Socket client threads produce, main thread consumes */
+static struct cmd_data cmd_queue[CMD_QUEUE_SIZE];
+static unsigned int cmd_queue_head;
+static unsigned int cmd_queue_tail;
+static unsigned int cmd_queue_overflow;
+static unsigned int cmd_id_ind;
+/* Client index of application in HDMI_INIT_DIRECT mode, or
+ * SOCKET_CLIENT_CALLBACK in HDMI_INIT_CALLBACK mode, else -1
+ */
+static int direct_client = -1;
+/* Shared memory ring of application, hdmi_event_ring_open */
+static struct hdmi_event_ring *event_ring;
+static int event_ring_evfd = -1;
 
 const __u8 plugdetdis_val[] = {0x00, 0x00, 0x00};/* 00: disable, 00:ontime,
 								00: offtime*/
 const __u8 plugdeten_val[] = {0x01, 0x05, 0x02};/* 01: enable, 05:ontime,
 								02: offtime*/
 
-static int hdmidirsort(const struct dirent **a, const struct dirent **b)
-{
-	return 1;
-}
-
-/* Find the correct device path since the device minor number can vary */
-static int dispdevice_path_set(void)
-{
-	struct dirent **namelist;
-	int n;
-	int found = 0;
-
-	n = scandir(DISPDEVICE_PATH_1, &namelist, 0, hdmidirsort);
-	if (n < 0) {
-		LOGHDMILIB("%s", "scandir error");
-		return -1;
-	}
-
-	while (n--) {
-		if (!found && strncmp(namelist[n]->d_name, DISPDEVICE_PATH_2,
-				strlen(DISPDEVICE_PATH_2)) == 0) {
-			strcpy(dispdevice_path, namelist[n]->d_name);
-			LOGHDMILIB("%s found:%s\n", __func__, dispdevice_path);
-			found = 1;
-		}
-		free(namelist[n]);
-	}
-	free(namelist);
-	return 0;
-}
-
-static char *dispdevice_path_get(void)
-{
-	return &dispdevice_path[0];
-}
-
-int dispdevice_file_open(char *file, int attr)
-{
-	int fd = -1;
-	char fname[128];
-
-	if (dispdevice_path[0] == 0)
-		dispdevice_path_set();
-
-	if (dispdevice_path[0] != 0) {
-		sprintf(fname, "%s%s/%s", DISPDEVICE_PATH_1,
-				dispdevice_path_get(), file);
-		fd = open(fname, attr);
-	}
-	return fd;
-}
-
+/* Get a unique cmd_id, > 0. Safe to call from several threads */
 int get_new_cmd_id_ind(void)
 {
-	cmd_id_ind++;
-	return cmd_id_ind;
+	unsigned int cmd_id;
+
+	do {
+		cmd_id = __atomic_add_fetch(&cmd_id_ind, 1, __ATOMIC_RELAXED) &
+								0x7FFFFFFF;
+	} while (cmd_id == 0);
+	return cmd_id;
 }
 
 /* Sets the format to be used in sysfs files */
 static int storeastext(int as_text)
 {
-	int storeastext;
-	int result = RESULT_OK;
 	int wr_res;
 	char *str;
 
@@ -139,35 +114,21 @@ static int storeastext(int as_text)
 		str = STOREASBIN_STR;
 
 	/* Set file format in sysfs files; hextext or binary */
-	storeastext = open(STOREASTEXT_FILE, O_WRONLY);
-	if (storeastext < 0) {
-		LOGHDMILIB("***** Failed to open %s *****", STOREASTEXT_FILE);
-		result = SYSFS_FILE_FAILED;
-		goto storeastext_end;
-	}
-	wr_res = write(storeastext, str, strlen(str));
-	close(storeastext);
+	wr_res = sysfs_write(SYSFS_STOREASTEXT, str, strlen(str));
+	if (wr_res < 0)
+		return SYSFS_FILE_FAILED;
 	if (wr_res != (int)strlen(str))
-		result = STOREAS_FAIL;
-
-storeastext_end:
-	return result;
+		return STOREAS_FAIL;
+	return RESULT_OK;
 }
 
 /* Trigger event in kernel event file */
 static int hdmievwakeupfile_wr(void)
 {
-	int evwakeup;
 	int res;
 	__u8 val = 1;
 
-	evwakeup = open(EVWAKEUP_FILE, O_WRONLY);
-	if (evwakeup < 0) {
-		LOGHDMILIB("***** Failed to open %s *****", EVWAKEUP_FILE);
-		return -1;
-	}
-	res = write(evwakeup, &val, 1);
-	close(evwakeup);
+	res = sysfs_write(SYSFS_EVWAKEUP, &val, 1);
 	if (res != 1) {
 		LOGHDMILIB("***** Failed to write %s *****", EVWAKEUP_FILE);
 		return -2;
@@ -178,36 +139,19 @@ static int hdmievwakeupfile_wr(void)
 /* Set hw power */
 int poweronoff(__u8 onoff)
 {
-	int pwrfd;
-	int ret = 0;
-
-	pwrfd = open(POWERONOFF_FILE, O_WRONLY);
-	if (pwrfd < 0) {
-		LOGHDMILIB(" failed to open %s", POWERONOFF_FILE);
-		return -1;
-	}
-	if (write(pwrfd, &onoff, 1) != 1)
-		ret = -2;
-	close(pwrfd);
-
-	return ret;
+	if (sysfs_write(SYSFS_POWERONOFF, &onoff, 1) != 1)
+		return -2;
+	return 0;
 }
 
 /* Get hw power */
 static int powerstate_get(enum hdmi_power_state *power_state)
 {
-	int pwrfd;
 	int res;
 	__u8 onoff;
 
 	*power_state = HDMI_POWERUNDEF;
-	pwrfd = open(POWERONOFF_FILE, O_RDONLY);
-	if (pwrfd < 0) {
-		LOGHDMILIB(" failed to open %s", POWERONOFF_FILE);
-		return -1;
-	}
-	res = read(pwrfd, &onoff, 1);
-	close(pwrfd);
+	res = sysfs_read(SYSFS_POWERONOFF, &onoff, 1);
 	if (res != 1)
 		return -1;
 	if (onoff)
@@ -234,23 +178,15 @@ static int plugstate_get(enum hdmi_plug_state *plug_state)
 /* Select HDMI or DVI mode */
 static int hdmi_format_set(enum hdmi_format format)
 {
-	int fd;
-	int ret = 0;
+	__u8 val = format;
 
-	fd = dispdevice_file_open(HDMIFORMAT_FILE, O_WRONLY);
-	if (fd < 0) {
-		LOGHDMILIB(" failed to open %s", HDMIFORMAT_FILE);
-		return -1;
-	}
-	if (write(fd, &format, 1) != 1)
-		ret = -2;
-	close(fd);
-
-	return ret;
+	if (sysfs_write(SYSFS_HDMIFORMAT, &val, 1) != 1)
+		return -2;
+	return 0;
 }
 
 /* Send illegal state message on client socket */
-static int illegalstate_send(__u32 cmd,  __u32 cmd_id)
+int illegalstate_send(__u32 cmd,  __u32 cmd_id)
 {
 	int val;
 	__u8 buf[16];
@@ -268,80 +204,196 @@ static int illegalstate_send(__u32 cmd,  __u32 cmd_id)
 /* Subscribe for plug events */
 int hdmiplug_subscribe(void)
 {
-	int plugdetenfd;
 	int res;
 
-	plugdetenfd = open(PLUGDETEN_FILE, O_WRONLY);
-	if (plugdetenfd < 0) {
-		LOGHDMILIB(" failed to open %s", PLUGDETEN_FILE);
-		goto hdmiplug_subscribe_err2;
-	}
-
 	/* Subscribe */
-	res = write(plugdetenfd, plugdeten_val, sizeof(plugdeten_val));
+	res = sysfs_write(SYSFS_PLUGDETEN, plugdeten_val,
+						sizeof(plugdeten_val));
 	if (res != sizeof(plugdeten_val))
-		goto hdmiplug_subscribe_err1;
-
-	close(plugdetenfd);
+		return -1;
 	return 0;
-
-hdmiplug_subscribe_err1:
-	close(plugdetenfd);
-hdmiplug_subscribe_err2:
-	return -1;
 }
 
 /* Allow-Avoid Early suspend */
 static int stayalive(__u8 enable)
 {
-	int stayalivefd;
-	int cnt = 0;
+	long long deadline = hdmi_time_us() + STAYALIVE_WAIT_US;
+	int left;
 	int res;
 
-	stayalivefd = dispdevice_file_open(STAYALIVE_FILE, O_WRONLY);
-	while ((stayalivefd < 0) && (cnt++ < 30)) {
-		usleep(200000);
-		stayalivefd = dispdevice_file_open(STAYALIVE_FILE, O_WRONLY);
+	while (sysfs_open(SYSFS_STAYALIVE) < 0) {
+		left = (int)((deadline - hdmi_time_us()) / 1000);
+		if (left <= 0)
+			break;
+		/* The files of the display device are created when the
+		 * driver binds, shortly after the device is added. Not all
+		 * kernels send a uevent for the bind, so once the device is
+		 * there, retry the open instead of waiting for one.
+		 */
+		if (dispdevice_present())
+			usleep((STAYALIVE_SETTLE_MS < left ?
+					STAYALIVE_SETTLE_MS : left) * 1000);
+		else
+			dispdevice_wait(STAYALIVE_POLL_MS < left ?
+					STAYALIVE_POLL_MS : left);
 	}
-	LOGHDMILIB("cnt:%d", cnt);
 
-	if (stayalivefd < 0) {
-		LOGHDMILIB(" failed to open %s", STAYALIVE_FILE);
-		goto stayalive_err2;
-	}
-	res = write(stayalivefd, &enable, 1);
+	res = sysfs_write(SYSFS_STAYALIVE, &enable, 1);
 	if (res != 1)
-		goto stayalive_err1;
+		return -1;
+	return 0;
+}
+
+/* Clear sink support, parse EDID block 0 in data and read and parse
+ * all extension blocks. Fills in profile from the parsed EDID.
+ * data is overwritten by the extension blocks.
+ */
+static int sink_edid_parse(__u8 *data, struct sink_profile *profile)
+{
+	struct vesacea_set sink;
+	struct edid_caps *caps = &profile->caps;
+	__u8 extension;
+	__u8 block;
+	int nr_supported;
+	long long start;
+	int res;
+
+	memset(&sink, 0, sizeof(sink));
+	video_formats_sink_map(&sink);
+
+	memset(profile, 0, sizeof(*profile));
+	profile->latency.video_latency = -1;
+	profile->latency.audio_latency = -1;
+	profile->latency.intlcd_video_latency = -1;
+	profile->latency.intlcd_audio_latency = -1;
+	sinkprofile_key(data + 1, profile->key);
+
+	start = hdmi_time_us();
+	res = edid_parse0(data + 1, &extension, &sink, caps);
+	start = stats_phase_end(PHASE_EDID0_PARSE, start);
+	if (res)
+		return res;
+
+	caps->nr_blocks = 1;
+	if (extension >= EDID_BLOCKS_MAX) {
+		LOGHDMILIB("EDID %d extensions, reading %d", extension,
+							EDID_BLOCKS_MAX - 1);
+		extension = EDID_BLOCKS_MAX - 1;
+	}
+
+	for (block = 1; block <= extension; block++) {
+		res = edid_acquire(block, data, EDIDREAD_DEADLINE1);
+		start = stats_phase_end(PHASE_EDID1_READ, start);
+		if (res == 0) {
+			res = edid_parse_ext(data + 1, &sink, caps,
+							&profile->latency);
+			start = stats_phase_end(PHASE_EDID1_PARSE, start);
+		}
+		if (res)
+			return res;
 
-	close(stayalivefd);
+		caps->nr_blocks++;
+		profile->ext_chksum += data[1 + EDID_CHKSUM_OFFSET];
+	}
+	profile->extension = extension;
+
+	LOGHDMILIB("EDID blocks:%d cea:%d dtds:%d svds:%d sads:%d y420:%d "
+			"hf:%d physaddr:%04x", caps->nr_blocks, caps->nr_cea,
+			caps->nr_dtds, caps->nr_svds, caps->nr_sads,
+			caps->nr_y420, caps->hf_version, caps->phys_addr);
+
+	profile->hdmi = caps->hdmi;
+	profile->basic_audio = !!(caps->cea_flags &
+					EDID_BASIC_AUDIO_SUPPORT_MASK);
+	video_formats_sink_map(&sink);
+	video_formats_native_set(&caps->native);
+	vesacea_supported(&nr_supported, profile->supported);
+	profile->nr_supported = nr_supported;
 	return 0;
+}
+
+/* Add the DDC reads since the last call to the counters of profile */
+static void sink_ddc_account(struct sink_profile *profile)
+{
+	if (edid_ddc_stats_take(&profile->ddc) == 0)
+		return;
 
-stayalive_err1:
-	close(stayalivefd);
-stayalive_err2:
-	return -1;
+	LOGHDMILIB("DDC errors read:%u header:%u chksum:%u of %u reads",
+			profile->ddc.read_errors, profile->ddc.header_errors,
+			profile->ddc.chksum_errors, profile->ddc.reads);
 }
 
-/* Handling of plug events */
-static int hdmiplugged_handle(int *basic_audio_support)
+/* Set hdmi or dvi format from sink profile */
+static void sink_format_set(struct sink_profile *profile)
+{
+	if (profile->hdmi)
+		/* Set hdmi format to hdmi */
+		hdmi_format_set(HDMI_FORMAT_HDMI);
+	else
+		/* Set hdmi format to dvi */
+		hdmi_format_set(HDMI_FORMAT_DVI);
+
+	LOGHDMILIB("Basic audio support: %d", profile->basic_audio);
+	LOGHDMILIB("Latency: video:%d audio:%d",
+			profile->latency.video_latency,
+			profile->latency.audio_latency);
+	LOGHDMILIB("Interlaced latency: video:%d audio:%d",
+			profile->latency.intlcd_video_latency,
+			profile->latency.intlcd_audio_latency);
+}
+
+/* Create frame buffer with format cea/vesaceanr if not already created */
+static int hdmi_fb_create(__u8 cea, __u8 vesaceanr)
 {
-	__u8 data[128];
-	int nr_formats;
-	__u8 cea;
-	__u8 vesaceanr;
-	int disponoff;
 	char req_str[7];
 	int wr_res;
 	char buf[128];
 	int read_res;
-	struct video_format *formats;
-	__u8 extension;
-	int cnt = 0;
-	struct edid_latency edid_latency = {-1, -1, -1, -1};
+
+	/* Check if fb is created */
+	/* Get fb dev name */
+	read_res = sysfs_read(SYSFS_DISPONOFF, buf, sizeof(buf));
+	if (read_res < 0)
+		return -3;
+	if (read_res > 0) {
+		LOGHDMILIB("fbname:%s", buf);
+	} else {
+		/* Create frame buffer with best resolution */
+		sprintf(req_str, "%02x%02x%02x", 1, cea, vesaceanr);
+		LOGHDMILIB("req_str:%s", req_str);
+
+		wr_res = sysfs_write(SYSFS_DISPONOFF, req_str,
+							strlen(req_str));
+		if (wr_res != (int)strlen(req_str)) {
+			LOGHDMILIB("***** Failed to write %s *****",
+					DISPONOFF_FILE);
+			return -4;
+		}
+
+		/* Check that fb was created */
+		/* Get fb dev name */
+		read_res = sysfs_read(SYSFS_DISPONOFF, buf, sizeof(buf));
+		if (read_res <= 0) {
+			LOGHDMILIB("***** Failed to read %s *****",
+						DISPONOFF_FILE);
+			return -5;
+		}
+
+		LOGHDMILIB("fbname:%s", buf);
+	}
+	return 0;
+}
+
+/* Handling of plug events */
+static int hdmiplugged_handle(int *basic_audio_support)
+{
+	__u8 data[EDIDREAD_BUF_SIZE];
+	struct sink_profile *profile;
 	int res;
 	int ret = 0;
 	enum hdmi_plug_state plug_state;
-	int hdmi_support = 0;
+	long long plug_start = hdmi_time_us();
+	long long start = plug_start;
 
 	LOGHDMILIB("%s", "HDMIEVENT_HDMIPLUGGED");
 
@@ -352,125 +404,76 @@ static int hdmiplugged_handle(int *basic_audio_support)
 
 	plugstate_set(HDMI_PLUGGED);
 	*basic_audio_support = 0;
+	plug_store_pending = 0;
+	plug_profile_valid = 0;
+	/* DDC reads before the plug are not of this sink */
+	edid_ddc_stats_take(NULL);
+	dispdevice_uevent_check();
 	video_formats_clear();
 
 	/* Behaviour at early suspend */
 	stayalive(HDMI_SERVICE_STAY_ALIVE_DURING_SUSPEND);
+	start = stats_phase_end(PHASE_STAYALIVE, start);
 
 	/* Set hdmi fb state */
 	hdmi_fb_state = HDMI_FB_OPENED;
 
 	/* Get HW supported formats */
 	video_formats_supported_hw();
-	nr_formats = nr_formats_get();
-	formats = video_formats_get();
-
-	cnt = 0;
-	/* Read and parse EDID */
-	res = -1;
-	while (res && (cnt < 3)) {
-		res = edid_read(0, data);
-		if (res == 0)
-			res = edid_parse0(data + 1, &extension, formats,
-						nr_formats);
-		if (res && (cnt < 2))
-			usleep(EDIDREAD_WAITTIME0);
-		cnt++;
-	}
+	start = stats_phase_end(PHASE_HWFORMATS, start);
+
+	/* Read EDID block 0 */
+	res = edid_acquire(0, data, EDIDREAD_DEADLINE0);
+	stats_phase_end(PHASE_EDID0_READ, start);
 	if (res) {
 		ret = -1;
 		goto hdmiplugged_handle_end;
 	}
-	if (extension) {
-		/* Extension data exists */
-		cnt = 0;
-		res = -1;
-		while (res && (cnt < 3)) {
-			res = edid_read(1, data);
-			if (res == 0)
-				res = edid_parse1(data + 1, formats, nr_formats,
-							basic_audio_support,
-							&edid_latency,
-							&hdmi_support);
-			if (res && (cnt < 2))
-				usleep(EDIDREAD_WAITTIME1);
-			cnt++;
-		}
 
+	profile = sinkprofile_find(data + 1);
+	if (profile) {
+		/* Known sink: use its profile now and verify EDID when
+		 * the frame buffer is up and the plug event is sent.
+		 */
+		memcpy(&plug_profile, profile, sizeof(plug_profile));
+		video_formats_sink_set(plug_profile.nr_supported,
+						plug_profile.supported);
+		plug_verify_pending = 1;
+	} else {
+		/* Parse EDID */
+		res = sink_edid_parse(data, &plug_profile);
 		if (res) {
 			ret = -1;
 			goto hdmiplugged_handle_end;
 		}
 
+		start = hdmi_time_us();
+		set_vesacea_prio_all();
+		get_best_videoformat(&plug_profile.cea,
+						&plug_profile.vesaceanr);
+		stats_phase_end(PHASE_BESTFORMAT, start);
 	}
 
-	if (hdmi_support) {
-		/* Set hdmi format to hdmi */
-		hdmi_format_set(HDMI_FORMAT_HDMI);
-		cea = 1;
-	} else {
-		/* Set hdmi format to dvi */
-		hdmi_format_set(HDMI_FORMAT_DVI);
-		cea = 0;
-	}
-
-	LOGHDMILIB("Basic audio support: %d", *basic_audio_support);
-	LOGHDMILIB("Latency: video:%d audio:%d",
-			edid_latency.video_latency,
-			edid_latency.audio_latency);
-	LOGHDMILIB("Interlaced latency: video:%d audio:%d",
-			edid_latency.intlcd_video_latency,
-			edid_latency.intlcd_audio_latency);
-
-	set_vesacea_prio_all();
-	get_best_videoformat(&cea, &vesaceanr);
+	*basic_audio_support = plug_profile.basic_audio;
+	sink_format_set(&plug_profile);
 
-	/* Check if fb is created */
-	/* Get fb dev name */
-	disponoff = dispdevice_file_open(DISPONOFF_FILE, O_RDWR);
-	if (disponoff < 0) {
-		LOGHDMILIB("***** Failed to open %s *****", DISPONOFF_FILE);
-		ret = -3;
+	start = hdmi_time_us();
+	ret = hdmi_fb_create(plug_profile.cea, plug_profile.vesaceanr);
+	if (ret)
 		goto hdmiplugged_handle_end;
-	}
-	read_res = read(disponoff, buf, sizeof(buf));
-	if (read_res > 0) {
-		LOGHDMILIB("fbname:%s", buf);
-	} else {
-		/* Create frame buffer with best resolution */
-		lseek(disponoff, 0, SEEK_SET);
-		sprintf(req_str, "%02x%02x%02x", 1, cea, vesaceanr);
-		LOGHDMILIB("req_str:%s", req_str);
-
-		wr_res = write(disponoff, req_str, strlen(req_str));
-		if (wr_res != (int)strlen(req_str)) {
-			LOGHDMILIB("***** Failed to write %s *****",
-					DISPONOFF_FILE);
-			close(disponoff);
-			ret = -4;
-			goto hdmiplugged_handle_end;
-		}
-
-		/* Check that fb was created */
-		/* Get fb dev name */
-		lseek(disponoff, 0, SEEK_SET);
-		read_res = read(disponoff, buf, sizeof(buf));
-		if (read_res <= 0) {
-			LOGHDMILIB("***** Failed to read %s *****",
-						DISPONOFF_FILE);
-			close(disponoff);
-			ret = -5;
-			goto hdmiplugged_handle_end;
-		}
-
-		LOGHDMILIB("fbname:%s", buf);
-	}
-	close(disponoff);
+	start = stats_phase_end(PHASE_FBCREATE, start);
 
 	/* Change resolution to be sure to have correct freq */
-	hdmi_fb_chres(cea, vesaceanr);
+	hdmi_fb_chres(plug_profile.cea, plug_profile.vesaceanr);
+	stats_phase_end(PHASE_CHRES, start);
+
+	/* Store new sink from timer, after the plug event is sent */
+	plug_profile_valid = 1;
+	if (!plug_verify_pending)
+		plug_store_pending = 1;
 
 hdmiplugged_handle_end:
+	stats_phase_end(PHASE_PLUG_TOTAL, plug_start);
 	LOGHDMILIB("%s end:%d", __func__, ret);
 	return ret;
 }
@@ -488,6 +491,11 @@ static int hdmiunplugged_handle(void)
 	}
 
 	plugstate_set(HDMI_UNPLUGGED);
+	plug_verify_pending = 0;
+	plug_profile_valid = 0;
+
+	/* No receiver, stop HDCP bring-up */
+	hdcp_abort();
 
 	/* Allow early suspend */
 	stayalive(0);
@@ -497,7 +505,6 @@ static int hdmiunplugged_handle(void)
 /* Close frame buffer */
 static int hdmi_fb_close(void)
 {
-	int disponoff;
 	char req_str[7];
 	int wr_res;
 
@@ -510,19 +517,12 @@ static int hdmi_fb_close(void)
 	}
 
 	/* Destroy frame buffer */
-	disponoff = dispdevice_file_open(DISPONOFF_FILE, O_WRONLY);
-	if (disponoff < 0) {
-		LOGHDMILIB("***** Failed to open %s *****", DISPONOFF_FILE);
-	} else {
-		sprintf(req_str, "%02x%02x%02x", 0, 0, 0);
-		LOGHDMILIB("req_str:%s", req_str);
+	sprintf(req_str, "%02x%02x%02x", 0, 0, 0);
+	LOGHDMILIB("req_str:%s", req_str);
 
-		wr_res = write(disponoff, req_str, strlen(req_str));
-		close(disponoff);
-		if (wr_res != (int)strlen(req_str))
-			LOGHDMILIB("***** Failed to write %s *****",
-						DISPONOFF_FILE);
-	}
+	wr_res = sysfs_write(SYSFS_DISPONOFF, req_str, strlen(req_str));
+	if (wr_res != (int)strlen(req_str))
+		LOGHDMILIB("***** Failed to write %s *****", DISPONOFF_FILE);
 
 	hdmievclr(EVENTMASK_ALL);
 
@@ -534,7 +534,6 @@ static int hdmi_fb_close(void)
 /* Send Infoframe */
 static int infofr_send(__u8 type, __u8 ver, __u8 crc, __u8 len, __u8 *data)
 {
-	int infofrfd;
 	char buf[128];
 	int res = 0;
 
@@ -546,22 +545,13 @@ static int infofr_send(__u8 type, __u8 ver, __u8 crc, __u8 len, __u8 *data)
 	buf[3] = len;
 	memcpy(&buf[4], data, len);
 
-	infofrfd = open(INFOFRSEND_FILE, O_WRONLY);
-	if (infofrfd <= 0) {
-		LOGHDMILIB("***** Failed to open %s *****\n", INFOFRSEND_FILE);
-		res = -1;
-		goto infofr_send_end;
-	}
-
-	res = write(infofrfd, buf, len + 4);
+	res = sysfs_write(SYSFS_INFOFRSEND, buf, len + 4);
 	if (res != len + 4) {
 		LOGHDMILIB("***** infofrsend failed %d *****\n", res);
 		res = -1;
 		goto infofr_send_end;
 	}
-
-	if (infofrfd > 0)
-		close(infofrfd);
+	res = 0;
 
 infofr_send_end:
 	LOGHDMILIB("%s end:%d", __func__, res);
@@ -603,318 +593,774 @@ static int plugevent_send(__u32 cmd, int audio_support, int nr,
 	return res;
 }
 
-/* Add command to list */
-int cmd_add(struct cmd_data *cmd)
+/* Send HDMI_CMDDONE message to the client that sent a handled command */
+int cmd_done_send(struct cmd_done *done, int result)
 {
-	struct cmd_data **cmd_obj;
-	struct cmd_data *cmd_new;
+	__u8 buf[CMDBUF_OFFSET + CMDDONE_SIZE];
+	long long now = hdmi_time_us();
+	__u32 val;
 
-	LOGHDMILIB("%s begin", __func__);
+	LOGHDMILIB("cmd:%d cmd_id:%x res:%d queue:%lldus exec:%lldus",
+			done->cmd, done->cmd_id, result,
+			done->start - done->queued, now - done->start);
 
-	cmd_new = malloc(sizeof(struct cmd_data));
-	if (cmd_new)
-		memcpy(cmd_new, cmd, sizeof(struct cmd_data));
-	else
-		return -1;
+	val = HDMI_CMDDONE;
+	memcpy(&buf[CMD_OFFSET], &val, 4);
+	memcpy(&buf[CMDID_OFFSET], &done->cmd_id, 4);
+	val = CMDDONE_SIZE;
+	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
+	memcpy(&buf[CMDBUF_OFFSET], &done->cmd, 4);
+	memcpy(&buf[CMDBUF_OFFSET + 4], &result, 4);
+	val = done->start - done->queued;
+	memcpy(&buf[CMDBUF_OFFSET + 8], &val, 4);
+	val = now - done->start;
+	memcpy(&buf[CMDBUF_OFFSET + 12], &val, 4);
+
+	/* Caller of a synchronous API function, if any */
+	cmd_wait_complete(done->cmd_id, result);
+
+	if (done->client < 0)
+		return clientsocket_send(buf, CMDBUF_OFFSET + CMDDONE_SIZE);
+	return clientsocket_send_to(done->client, buf,
+					CMDBUF_OFFSET + CMDDONE_SIZE);
+}
 
-	/* Add to list */
-	pthread_mutex_lock(&cmd_mutex);
-	cmd_obj = &cmd_data;
-	while (*cmd_obj != NULL)
-		cmd_obj = &((*cmd_obj)->next);
-	*cmd_obj = cmd_new;
-	pthread_mutex_unlock(&cmd_mutex);
+/* Initialise command queue. Each slot sequence is set to the position
+ * at which it can be reserved by a producer.
+ */
+static void cmd_queue_init(void)
+{
+	unsigned int index;
 
-	LOGHDMILIB("%s end", __func__);
-	return 0;
+	for (index = 0; index < CMD_QUEUE_SIZE; index++)
+		cmd_queue[index].seq = index;
+	cmd_queue_head = 0;
+	cmd_queue_tail = 0;
+	cmd_queue_overflow = 0;
 }
 
-/* Delete command list */
-static int cmd_del_all(void)
+/* Reserve nr consecutive free slots in command queue. Safe to call from
+ * several threads. Slots are released in order, so all nr are free if the
+ * last one is. Returns the first slot, or NULL if the queue is full.
+ */
+struct cmd_data *cmd_reserve_n(unsigned int nr)
 {
-	struct cmd_data **cmd_obj;
-	struct cmd_data *cmd_del;
-
-	LOGHDMILIB("%s begin", __func__);
-	pthread_mutex_lock(&cmd_mutex);
-	cmd_obj = &cmd_data;
-	while (*cmd_obj != NULL) {
-		cmd_del = *cmd_obj;
-		cmd_obj = &((*cmd_obj)->next);
-		free(cmd_del);
+	struct cmd_data *last;
+	unsigned int pos;
+	unsigned int seq;
+
+	if ((nr == 0) || (nr > CMD_QUEUE_SIZE))
+		return NULL;
+
+	pos = __atomic_load_n(&cmd_queue_head, __ATOMIC_RELAXED);
+	while (1) {
+		last = &cmd_queue[(pos + nr - 1) & (CMD_QUEUE_SIZE - 1)];
+		seq = __atomic_load_n(&last->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos + nr - 1) {
+			/* Free, try to take them */
+			if (__atomic_compare_exchange_n(&cmd_queue_head, &pos,
+						pos + nr, 1, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+				return &cmd_queue[pos & (CMD_QUEUE_SIZE - 1)];
+		} else if ((int)(seq - (pos + nr - 1)) < 0) {
+			/* Not yet released by consumer, queue is full */
+			return NULL;
+		} else {
+			/* Taken by another producer */
+			pos = __atomic_load_n(&cmd_queue_head,
+						__ATOMIC_RELAXED);
+		}
 	}
-	pthread_mutex_unlock(&cmd_mutex);
-	LOGHDMILIB("%s end", __func__);
-	return 0;
 }
 
-/* Signal an event to main thread */
-int hdmi_event(int event)
+/* Reserve a free slot in command queue. Returns NULL if the queue is full */
+struct cmd_data *cmd_reserve(void)
 {
-	pthread_mutex_lock(&event_mutex);
-	hdmi_events |= event;
-	if (hdmi_events)
-		pthread_cond_signal(&event_cond);
-	pthread_mutex_unlock(&event_mutex);
-	return 0;
+	return cmd_reserve_n(1);
 }
 
-/* Handling of received command */
-static int hdmi_eventcmd(void)
+/* Slot following slot in command queue */
+struct cmd_data *cmd_next(struct cmd_data *slot)
 {
-	struct cmd_data *cmd_obj = NULL;
-	int res = 0;
-	int ret = -1;
-	enum hdmi_power_state power_state;
-	enum hdmi_plug_state plug_state;
-	int handlecmd;
+	return &cmd_queue[(slot - cmd_queue + 1) & (CMD_QUEUE_SIZE - 1)];
+}
 
-	LOGHDMILIB("%s begin", __func__);
+/* Make a reserved slot visible to the consumer */
+void cmd_commit(struct cmd_data *slot)
+{
+	slot->time = hdmi_time_us();
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
 
-	pthread_mutex_lock(&cmd_mutex);
-	if (cmd_data) {
-		cmd_obj = cmd_data;
-		cmd_data = cmd_data->next;
-	}
-	pthread_mutex_unlock(&cmd_mutex);
+/* Get first command in queue, or NULL if empty. Main thread only */
+static struct cmd_data *cmd_first(void)
+{
+	struct cmd_data *slot;
 
-	/* Handle all mesages in list */
-	while (cmd_obj) {
-		res = -1;
-		handlecmd = 1;
-		ret = cmd_obj->cmd;
-
-		/* Check power and plug state */
-		switch (cmd_obj->cmd) {
-		case HDMI_ENABLE:
-		case HDMI_DISABLE:
-		case HDMI_EXIT:
-		case HDMI_CECSEND:
-		default:
-			break;
+	slot = &cmd_queue[cmd_queue_tail & (CMD_QUEUE_SIZE - 1)];
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) !=
+						cmd_queue_tail + 1)
+		return NULL;
+	return slot;
+}
 
-		case HDMI_EDIDREQ:
-		case HDMI_FB_RES_SET:
-		case HDMI_HDCP_INIT:
-		case HDMI_INFOFR:
-			handlecmd = 0;
-			powerstate_get(&power_state);
-			plugstate_get(&plug_state);
-			if (power_state != HDMI_POWERON)
-				illegalstate_send(HDMI_ILLSTATE_UNPOWERED,
-							cmd_obj->cmd_id);
-			else if (plug_state != HDMI_PLUGGED)
-				illegalstate_send(HDMI_ILLSTATE_UNPLUGGED,
-							cmd_obj->cmd_id);
-			else
-				handlecmd = 1;
-			break;
+/* Give first command slot back to producers. Main thread only */
+static void cmd_release(struct cmd_data *slot)
+{
+	__atomic_store_n(&slot->seq, cmd_queue_tail + CMD_QUEUE_SIZE,
+				__ATOMIC_RELEASE);
+	cmd_queue_tail++;
+}
 
-		case HDMI_FB_RELEASE:
-			handlecmd = 0;
-			powerstate_get(&power_state);
-			plugstate_get(&plug_state);
-			if ((power_state == HDMI_POWERON) &&
-						(plug_state == HDMI_PLUGGED))
-				illegalstate_send(HDMI_ILLSTATE_PWRON_PLUGGED,
-							cmd_obj->cmd_id);
-			else
-				handlecmd = 1;
-			break;
-		}
+/* Report command cmd_id as dropped since the queue is full */
+void cmd_overflow(__u32 cmd, __u32 cmd_id)
+{
+	__atomic_add_fetch(&cmd_queue_overflow, 1, __ATOMIC_RELAXED);
+	LOGHDMILIB("%s queue full, cmd:%d cmd_id:%x dropped", __func__,
+				cmd, cmd_id);
+	illegalstate_send(HDMI_CMDQUEUE_FULL, cmd_id);
+	cmd_wait_complete(cmd_id, -ENOBUFS);
+}
 
-		if (handlecmd == 0)
-			break;
+/* Reserve a slot for command cmd from client and fill in cmd, cmd_id
+ * and client. If the queue is full the command is reported as dropped and
+ * NULL is returned. The slot must be given to cmd_commit when filled in.
+ */
+struct cmd_data *cmd_alloc(__u32 cmd, __u32 cmd_id, int client)
+{
+	struct cmd_data *slot;
 
-		/* Handle cmd */
-		switch (cmd_obj->cmd) {
-		case HDMI_ENABLE:
-			/* Subscribe on plug events */
-			hdmiplug_subscribe();
+	slot = cmd_reserve();
+	if (slot == NULL) {
+		cmd_overflow(cmd, cmd_id);
+		return NULL;
+	}
 
-			/* Subscribe for cec events */
-			res = cecrx_subscribe();
-			break;
+	slot->cmd = cmd;
+	slot->cmd_id = cmd_id;
+	slot->client = client;
+	return slot;
+}
 
-		case HDMI_DISABLE:
-			res = hdmi_fb_close();
-			break;
+/* Add command from client to queue */
+int cmd_add(__u32 cmd, __u32 cmd_id, int client, __u32 len, __u8 *data)
+{
+	struct cmd_data *slot;
 
-		case HDMI_EDIDREQ:
-			res = edidreq(cmd_obj->data[0], cmd_obj->cmd_id);
-			break;
+	if (len > CMD_DATA_MAX)
+		return -1;
 
-		case HDMI_CECSEND:
-			res = cecsend(cmd_obj->cmd_id,
-					cmd_obj->data[0],
-					cmd_obj->data[1],
-					cmd_obj->data[2],
-					&cmd_obj->data[3]);
-			break;
+	slot = cmd_alloc(cmd, cmd_id, client);
+	if (slot == NULL)
+		return -1;
 
-		case HDMI_FB_RES_SET:
-			res = hdmi_fb_chres(cmd_obj->data[0], cmd_obj->data[1]);
-			break;
+	slot->data_len = len;
+	if (len)
+		memcpy(slot->data, data, len);
+	cmd_commit(slot);
+	return 0;
+}
 
-		case HDMI_FB_RELEASE:
-			hdmi_fb_close();
+/* Delete all commands in queue */
+static int cmd_del_all(void)
+{
+	struct cmd_data *cmd_obj;
 
-			/* Subscribe on plug events */
-			hdmiplug_subscribe();
+	LOGHDMILIB("%s begin", __func__);
+	while ((cmd_obj = cmd_first()) != NULL)
+		cmd_release(cmd_obj);
+	LOGHDMILIB("%s end", __func__);
+	return 0;
+}
 
-			/* Subscribe for cec events */
-			res = cecrx_subscribe();
-			break;
+/* Monotonic time in microseconds */
+long long hdmi_time_us(void)
+{
+	struct timespec ts;
 
-		case HDMI_HDCP_INIT:
-			if (cmd_obj->data_len !=
-					(AES_KEYS_SIZE + CMDBUF_OFFSET))
-				res = -1;
-			else
-				res = hdcp_init(cmd_obj->data);
-			break;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-		case HDMI_VESACEAPRIO_SET:
-			res = vesaceaprio_set(cmd_obj->data[0],
-						&cmd_obj->data[1]);
-			break;
+/* Verify EDID of a sink that was plugged using its stored profile.
+ * If the sink differs from the profile, the profile is updated, the
+ * video format is selected again and the plug event is resent.
+ */
+static int hdmiplugged_verify(void)
+{
+	__u8 data[EDIDREAD_BUF_SIZE];
+	struct sink_profile profile;
+	enum hdmi_plug_state plug_state;
+	long long start = hdmi_time_us();
+	int formats_changed;
+	int res;
 
-		case HDMI_INFOFR:
-			res = infofr_send(cmd_obj->data[0],
-						cmd_obj->data[1],
-						cmd_obj->data[2],
-						cmd_obj->data[3],
-						&cmd_obj->data[4]);
-			break;
+	plug_verify_pending = 0;
+	if ((plugstate_get(&plug_state) != 0) || (plug_state != HDMI_PLUGGED))
+		return -1;
 
-		case HDMI_EXIT:
-			hdmi_fb_close();
-			res = 0;
+	res = edid_acquire(0, data, EDIDREAD_DEADLINE1);
+	if (res == 0)
+		res = sink_edid_parse(data, &profile);
+	if (res) {
+		LOGHDMILIB("%s: EDID read failed, keep profile", __func__);
+		video_formats_sink_set(plug_profile.nr_supported,
+						plug_profile.supported);
+		goto hdmiplugged_verify_end;
+	}
 
-			/* delete list */
-			cmd_del_all();
+	set_vesacea_prio_all();
+	get_best_videoformat(&profile.cea, &profile.vesaceanr);
+	/* Keep the applied format while the sink supports it */
+	if (video_format_supported(plug_profile.cea, plug_profile.vesaceanr)) {
+		profile.cea = plug_profile.cea;
+		profile.vesaceanr = plug_profile.vesaceanr;
+	}
+	if (memcmp(profile.key, plug_profile.key, SINKPROFILE_KEY_SIZE) == 0)
+		profile.ddc = plug_profile.ddc;
 
-			hdmievwakeupfile_wr();
+	if (memcmp(&profile, &plug_profile,
+			offsetof(struct sink_profile, lru)) == 0) {
+		LOGHDMILIB("%s: profile ok", __func__);
+		goto hdmiplugged_verify_end;
+	}
 
-			goto hdmi_eventcmd_end;
-			break;
+	LOGHDMILIB("%s: profile changed", __func__);
+	formats_changed = (profile.basic_audio != plug_profile.basic_audio) ||
+			(profile.nr_supported != plug_profile.nr_supported) ||
+			memcmp(profile.supported, plug_profile.supported,
+				profile.nr_supported * sizeof(struct vesacea));
+	if (profile.hdmi != plug_profile.hdmi)
+		sink_format_set(&profile);
+	if ((profile.cea != plug_profile.cea) ||
+			(profile.vesaceanr != plug_profile.vesaceanr))
+		hdmi_fb_chres(profile.cea, profile.vesaceanr);
+
+	memcpy(&plug_profile, &profile, sizeof(plug_profile));
+
+	if (formats_changed)
+		plugevent_send(HDMI_PLUGGED_EV, plug_profile.basic_audio,
+					plug_profile.nr_supported,
+					plug_profile.supported);
+
+hdmiplugged_verify_end:
+	sink_ddc_account(&plug_profile);
+	sinkprofile_store(&plug_profile);
+	stats_phase_end(PHASE_VERIFY, start);
+	return res;
+}
 
-		default:
-			break;
-		}
+/* Time in ms until hdmi_timers_run needs to be called, -1 for no timer */
+int hdmi_timeout_get(void)
+{
+	if (plug_verify_pending || plug_store_pending)
+		return 0;
+	return hdcp_timeout_get();
+}
 
-		LOGHDMILIB("cmd:%d cmd_id:%x res:%d\n", cmd_obj->cmd,
-							cmd_obj->cmd_id, res);
+/* Run expired timers */
+void hdmi_timers_run(void)
+{
+	if (plug_verify_pending)
+		hdmiplugged_verify();
+	if (plug_store_pending) {
+		plug_store_pending = 0;
+		sink_ddc_account(&plug_profile);
+		sinkprofile_store(&plug_profile);
+	}
+	hdcp_timer();
+}
 
-		free(cmd_obj);
+/* Add one event to journal. event_mutex must be held.
+ * Events that only mean "check current state" are coalesced with an event
+ * of the same type not yet handled. Plug and CEC events are never
+ * coalesced; they are dropped and counted if the journal is full.
+ */
+static void event_journal_add(int event, long long time)
+{
+	struct hdmi_event_rec *rec;
+	unsigned int index;
+
+	if (event & EVENTMASK_COALESCE) {
+		for (index = event_tail; index != event_head; index++)
+			if (event_journal[index % EVENT_JOURNAL_SIZE].event ==
+								event)
+				break;
+		if ((index != event_head) || (event_pending & event)) {
+			event_coalesced++;
+			return;
+		}
+	}
 
-		pthread_mutex_lock(&cmd_mutex);
-		if (cmd_data) {
-			cmd_obj = cmd_data;
-			cmd_data = cmd_data->next;
-		} else
-			cmd_obj = NULL;
-		pthread_mutex_unlock(&cmd_mutex);
+	if (event_head - event_tail >= EVENT_JOURNAL_SIZE) {
+		if (event & EVENTMASK_COALESCE) {
+			/* Keep it outside journal, it will not be lost */
+			event_pending |= event;
+			event_coalesced++;
+		} else {
+			event_dropped++;
+			LOGHDMILIB("%s journal full, event:%x dropped",
+					__func__, event);
+		}
+		return;
 	}
 
-hdmi_eventcmd_end:
-	LOGHDMILIB("%s end", __func__);
+	rec = &event_journal[event_head % EVENT_JOURNAL_SIZE];
+	rec->seq = event_head;
+	rec->event = event;
+	rec->time = time;
+	event_head++;
+}
 
-	if (res != 0)
-		ret = res;
+/* Add events to journal without waking up main thread.
+ * Bits in a kernel event mask are added lowest first.
+ */
+int hdmi_event_queue(int event)
+{
+	long long time = hdmi_time_us();
+	unsigned int bits = (unsigned int)event;
+	int bit;
 
-	return ret;
+	pthread_mutex_lock(&event_mutex);
+	for (bit = 0; bit < 32; bit++)
+		if (bits & (1U << bit))
+			event_journal_add((int)(1U << bit), time);
+	pthread_mutex_unlock(&event_mutex);
+	return 0;
 }
 
-static int hdmi_service_exit_do(void)
+/* Signal an event to main thread */
+int hdmi_event(int event)
 {
-	int sock;
+	hdmi_event_queue(event);
+
+	pthread_mutex_lock(&event_mutex);
+	if (event_head != event_tail)
+		pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+
+	/* Wake up reactor thread, if used */
+	reactor_wakeup();
+	return 0;
+}
+
+/* Get next event from journal. event_mutex must be held.
+ * Returns 0 if there is no event.
+ */
+static int event_journal_get(struct hdmi_event_rec *rec)
+{
+	int bit;
+
+	if (event_head != event_tail) {
+		*rec = event_journal[event_tail % EVENT_JOURNAL_SIZE];
+		event_tail++;
+		return 1;
+	}
+
+	if (event_pending) {
+		/* Events that did not fit in journal */
+		for (bit = 0; !(event_pending & (1 << bit)); bit++)
+			;
+		rec->seq = event_head;
+		rec->event = 1 << bit;
+		rec->time = hdmi_time_us();
+		event_pending &= ~rec->event;
+		return 1;
+	}
+	return 0;
+}
+
+/* Remember video format set by a client in the profile of plugged sink */
+static void plug_format_set(__u8 cea, __u8 vesaceanr)
+{
+	if (!plug_profile_valid || ((plug_profile.cea == cea) &&
+			(plug_profile.vesaceanr == vesaceanr)))
+		return;
+
+	plug_profile.cea = cea;
+	plug_profile.vesaceanr = vesaceanr;
+	/* A pending verify stores the profile */
+	if (!plug_verify_pending)
+		plug_store_pending = 1;
+}
+
+/* Handle one received command. Returns the result of the command */
+int hdmi_cmd_handle(struct cmd_data *cmd_obj)
+{
+	int res = -1;
+	enum hdmi_power_state power_state;
+	enum hdmi_plug_state plug_state;
+
+	/* Check power and plug state */
+	switch (cmd_obj->cmd) {
+	case HDMI_ENABLE:
+	case HDMI_DISABLE:
+	case HDMI_EXIT:
+	case HDMI_CECSEND:
+	default:
+		break;
+
+	case HDMI_EDIDREQ:
+	case HDMI_FB_RES_SET:
+	case HDMI_HDCP_INIT:
+	case HDMI_INFOFR:
+		powerstate_get(&power_state);
+		plugstate_get(&plug_state);
+		if (power_state != HDMI_POWERON) {
+			illegalstate_send(HDMI_ILLSTATE_UNPOWERED,
+						cmd_obj->cmd_id);
+			return -1;
+		} else if (plug_state != HDMI_PLUGGED) {
+			illegalstate_send(HDMI_ILLSTATE_UNPLUGGED,
+						cmd_obj->cmd_id);
+			return -1;
+		}
+		break;
+
+	case HDMI_FB_RELEASE:
+		powerstate_get(&power_state);
+		plugstate_get(&plug_state);
+		if ((power_state == HDMI_POWERON) &&
+					(plug_state == HDMI_PLUGGED)) {
+			illegalstate_send(HDMI_ILLSTATE_PWRON_PLUGGED,
+						cmd_obj->cmd_id);
+			return -1;
+		}
+		break;
+	}
+
+	/* Handle cmd */
+	switch (cmd_obj->cmd) {
+	case HDMI_ENABLE:
+		/* Subscribe on plug events */
+		hdmiplug_subscribe();
+
+		/* Subscribe for cec events */
+		res = cecrx_subscribe();
+		break;
+
+	case HDMI_DISABLE:
+		res = hdmi_fb_close();
+		break;
+
+	case HDMI_EDIDREQ:
+		res = edidreq(cmd_obj->data[0], cmd_obj->cmd_id);
+		break;
+
+	case HDMI_CECSEND:
+		res = cecsend(cmd_obj->cmd_id,
+				cmd_obj->data[0],
+				cmd_obj->data[1],
+				cmd_obj->data[2],
+				&cmd_obj->data[3]);
+		break;
+
+	case HDMI_FB_RES_SET:
+		res = hdmi_fb_chres(cmd_obj->data[0], cmd_obj->data[1]);
+		if (res == 0)
+			plug_format_set(cmd_obj->data[0], cmd_obj->data[1]);
+		break;
+
+	case HDMI_FB_RELEASE:
+		hdmi_fb_close();
+
+		/* Subscribe on plug events */
+		hdmiplug_subscribe();
+
+		/* Subscribe for cec events */
+		res = cecrx_subscribe();
+		break;
+
+	case HDMI_HDCP_INIT:
+		if (cmd_obj->data_len != AES_KEYS_SIZE)
+			res = -1;
+		else
+			res = hdcp_init(cmd_obj->data);
+		break;
+
+	case HDMI_VESACEAPRIO_SET:
+		res = vesaceaprio_set(cmd_obj->data[0],
+					&cmd_obj->data[1]);
+		break;
+
+	case HDMI_INFOFR:
+		res = infofr_send(cmd_obj->data[0],
+					cmd_obj->data[1],
+					cmd_obj->data[2],
+					cmd_obj->data[3],
+					&cmd_obj->data[4]);
+		break;
+
+	case HDMI_STATSREQ:
+		res = stats_send(cmd_obj->cmd_id);
+		break;
+
+	case HDMI_EXIT:
+		hdcp_abort();
+		hdmi_fb_close();
+		res = 0;
+
+		hdmievwakeupfile_wr();
+		break;
+
+	default:
+		break;
+	}
+
+	return res;
+}
+
+/* Handling of received commands in queue.
+ * Returns HDMI_EXIT if an exit command was handled.
+ */
+static int hdmi_eventcmd(void)
+{
+	struct cmd_data *cmd_obj;
+	struct cmd_done done;
+	struct cmd_done batch;
+	__u32 batch_left = 0;
+	int batch_res = 0;
+	int ret = 0;
 	int res;
 
 	LOGHDMILIB("%s begin", __func__);
 
-	/* Shutdown listen socket to end listen thread */
-	sock = listensocket_get();
-	listensocket_set(-1);
-	res = shutdown(sock, SHUT_RDWR);
+	/* Handle all mesages in queue */
+	while ((cmd_obj = cmd_first()) != NULL) {
+		done.cmd = cmd_obj->cmd;
+		done.cmd_id = cmd_obj->cmd_id;
+		done.client = cmd_obj->client;
+		done.queued = cmd_obj->time;
+		done.start = hdmi_time_us();
+
+		if (cmd_obj->cmd == HDMI_BATCH) {
+			/* Its commands follow, all in queue */
+			batch = done;
+			batch_res = 0;
+			memcpy(&batch_left, cmd_obj->data, 4);
+			cmd_release(cmd_obj);
+			continue;
+		}
+
+		res = hdmi_cmd_handle(cmd_obj);
+
+		if (batch_left) {
+			/* Answer batch when its last command is done */
+			if ((res < 0) && (batch_res == 0))
+				batch_res = res;
+			if (--batch_left == 0)
+				cmd_done_send(&batch, batch_res);
+		} else if ((cmd_obj->cmd != HDMI_HDCP_INIT) ||
+				(res != HDCP_OK) || !hdcp_done_defer(&done)) {
+			/* HDCP bring-up reports when it has ended */
+			cmd_done_send(&done, res);
+		}
+
+		if (cmd_obj->cmd == HDMI_EXIT) {
+			cmd_release(cmd_obj);
+
+			/* delete queue */
+			cmd_del_all();
+			ret = HDMI_EXIT;
+			break;
+		}
+
+		cmd_release(cmd_obj);
+	}
+
+	LOGHDMILIB("%s end", __func__);
+	return ret;
+}
+
+/* Handle one kernel or command event.
+ * Returns HDMI_EXIT if an exit command was handled.
+ */
+static int hdmi_event_handle(int event)
+{
+	int audio_support;
+	int nr_video;
+	struct vesacea video_supported[FORMATS_MAX];
+
+	switch (event) {
+	/* kernel events */
+	case HDMIEVENT_HDMIPLUGGED:
+		if (hdmiplugged_handle(&audio_support) == 0) {
+			vesacea_supported(&nr_video, video_supported);
+			plugevent_send(HDMI_PLUGGED_EV, audio_support,
+					nr_video,
+					video_supported);
+		}
+		break;
+
+	case HDMIEVENT_HDMIUNPLUGGED:
+		if (hdmiunplugged_handle() == 0)
+			plugevent_send(HDMI_UNPLUGGED_EV, 0, 0, NULL);
+		break;
+
+	case HDMIEVENT_CEC:
+		cecrx();
+		break;
+
+	case HDMIEVENT_HDCP:
+		hdcp_state();
+		break;
+
+	case HDMIEVENT_CECTXERR:
+		cecsenderr();
+		break;
+
+	/* App cmd event */
+	case HDMIEVENT_CMD:
+		return hdmi_eventcmd();
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/* Handle all events in journal, in order.
+ * Returns HDMI_EXIT if an exit command was handled.
+ */
+int hdmi_events_handle(void)
+{
+	struct hdmi_event_rec rec;
+	int found;
+
+	while (1) {
+		pthread_mutex_lock(&event_mutex);
+		found = event_journal_get(&rec);
+		pthread_mutex_unlock(&event_mutex);
+		if (!found)
+			break;
+
+		LOGHDMILIB("%s: seq:%u event:%x delay:%lldus", __func__,
+				rec.seq, rec.event, hdmi_time_us() - rec.time);
+
+		if (hdmi_event_handle(rec.event) == HDMI_EXIT)
+			return HDMI_EXIT;
+	}
+	return 0;
+}
+
+/* Empty event journal */
+void hdmi_events_clear(void)
+{
+	pthread_mutex_lock(&event_mutex);
+	event_tail = event_head;
+	event_pending = 0;
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Release service resources. All other service threads have exited */
+int hdmi_service_exit_do(void)
+{
+	LOGHDMILIB("%s begin", __func__);
+	direct_client = -1;
+	LOGHDMILIB("cmd queue overflows:%u", cmd_queue_overflow);
+	LOGHDMILIB("events coalesced:%u dropped:%u", event_coalesced,
+							event_dropped);
+	stats_dump();
+	sockclient_stats_dump();
+	sysfs_close_all();
+	dispdevice_exit();
+	sinkprofile_dump();
 
 	pthread_mutex_destroy(&event_mutex);
-	pthread_mutex_destroy(&cmd_mutex);
 	pthread_mutex_destroy(&fb_state_mutex);
 	pthread_cond_destroy(&event_cond);
 
 	LOGHDMILIB("%s end", __func__);
-	return res;
+	return 0;
+}
+
+/* Signal from main or reactor thread that the listen socket is bound */
+void hdmi_service_ready(int ok)
+{
+	pthread_mutex_lock(&ready_mutex);
+	service_ready = ok ? 1 : -1;
+	pthread_cond_broadcast(&ready_cond);
+	pthread_mutex_unlock(&ready_mutex);
+}
+
+/* Wait until listen socket is bound. Returns 0 if service is ready */
+static int hdmi_service_ready_wait(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += SERVICE_READY_TIMEOUT;
+
+	pthread_mutex_lock(&ready_mutex);
+	while (service_ready == 0)
+		if (pthread_cond_timedwait(&ready_cond, &ready_mutex, &ts))
+			break;
+	pthread_mutex_unlock(&ready_mutex);
+
+	return service_ready == 1 ? 0 : -1;
 }
 
 /* Main thread. Handles messages from client thread or kernel event thread */
 static void thread_main_fn(void *arg)
 {
-	int events;
 	int cont = 1;
 	int dummy = 0;
-	int res;
-	int audio_support;
-	int nr_video;
-	struct vesacea video_supported[FORMATS_MAX];
+	int timeout;
+	int sock;
+	struct timespec ts;
 
 	LOGHDMILIB("%s begin", __func__);
 
-	pthread_create(&thread_kevent, NULL, (void *)thread_kevent_fn,
-			(void *)&dummy);
+	kevent_thread_start();
 
 	pthread_create(&thread_socklisten, NULL, (void *)thread_socklisten_fn,
 			(void *)&dummy);
 
 	while (cont) {
 		/* Wait for event */
+		timeout = hdmi_timeout_get();
 		pthread_mutex_lock(&event_mutex);
-		if (hdmi_events == 0)
+		if ((event_head == event_tail) && (event_pending == 0) &&
+								timeout) {
 			/* Wait only if there are no events pending.
 			 * event_mutex is automatically unlocked while waiting
 			 * and locked again when thread is awakened.
 			 */
-			pthread_cond_wait(&event_cond, &event_mutex);
-		events = hdmi_events;
-		hdmi_events = 0;
-		pthread_mutex_unlock(&event_mutex);
-
-		LOGHDMILIB("%s: event:%x", __func__, events);
-
-		/* kernel events */
-		if (events & HDMIEVENT_HDMIPLUGGED) {
-			if (hdmiplugged_handle(&audio_support) == 0) {
-				vesacea_supported(&nr_video, video_supported);
-				plugevent_send(HDMI_PLUGGED_EV, audio_support,
-						nr_video,
-						video_supported);
+			if (timeout < 0) {
+				pthread_cond_wait(&event_cond, &event_mutex);
+			} else {
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				ts.tv_sec += timeout / 1000;
+				ts.tv_nsec += (timeout % 1000) * 1000000;
+				if (ts.tv_nsec >= 1000000000) {
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000000000;
+				}
+				pthread_cond_timedwait(&event_cond,
+						&event_mutex, &ts);
 			}
-		} else if (events & HDMIEVENT_HDMIUNPLUGGED) {
-			if (hdmiunplugged_handle() == 0)
-				plugevent_send(HDMI_UNPLUGGED_EV, 0, 0, NULL);
 		}
+		pthread_mutex_unlock(&event_mutex);
 
-		if (events & HDMIEVENT_CEC)
-			cecrx();
-		if (events & HDMIEVENT_HDCP)
-			hdcp_state();
-		if (events & HDMIEVENT_CECTXERR)
-			cecsenderr();
-
-		/* App cmd event */
-		if (events & HDMIEVENT_CMD) {
-			res = hdmi_eventcmd();
-			if (res == HDMI_EXIT) {
-				cont = 0;
-				/* Wait for kevent thread to exit */
-				usleep(2000000);
-			}
-		}
+		hdmi_timers_run();
+
+		if (hdmi_events_handle() == HDMI_EXIT)
+			cont = 0;
 	}
 
-	pthread_mutex_lock(&event_mutex);
-	hdmi_events = 0;
-	pthread_mutex_unlock(&event_mutex);
+	/* Wait for kevent, listen and client threads to exit.
+	 * Shutdown of listen socket ends listen thread.
+	 */
+	kevent_thread_stop();
+	sock = listensocket_get();
+	listensocket_set(-1);
+	if (sock >= 0)
+		shutdown(sock, SHUT_RDWR);
+	pthread_join(thread_socklisten, NULL);
+	sockclient_stop_all();
+
+	hdmi_events_clear();
 
 	hdmi_service_exit_do();
 
@@ -925,270 +1371,537 @@ static void thread_main_fn(void *arg)
 }
 
 /* API helper functions */
-int hdmi_service_init(int avoid_return_msg)
+int hdmi_service_init(int flags)
 {
 	int dummy = 0;
 	int socket;
+	pthread_condattr_t condattr;
+	long long start = hdmi_time_us();
 
 	LOGHDMILIB("%s begin", __func__);
 
-#ifdef HDMI_SERVICE_USE_CALLBACK_FN
-	hdmi_service_callback_set(NULL);
-#endif /*HDMI_SERVICE_USE_CALLBACK_FN*/
-
 	/* Set sysfs format to binary */
 	storeastext(0);
+	dispdevice_init();
 
 	vesacea_prio_default();
+	stats_clear();
 
+	event_head = 0;
+	event_tail = 0;
+	event_pending = 0;
+	event_coalesced = 0;
+	event_dropped = 0;
 	pthread_mutex_init(&event_mutex, NULL);
-	pthread_mutex_init(&cmd_mutex, NULL);
+	cmd_queue_init();
 	pthread_mutex_init(&fb_state_mutex, NULL);
-	pthread_cond_init(&event_cond, NULL);
+	/* Timed waits use monotonic time */
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&event_cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+
+	service_ready = 0;
+	socket_type_set((flags & HDMI_INIT_SEQPACKET) ?
+					SOCK_SEQPACKET : SOCK_STREAM);
 
 	/* Create threads */
-	pthread_create(&thread_main, NULL, (void *)thread_main_fn,
-			(void *)&dummy);
+	if (flags & HDMI_INIT_REACTOR)
+		pthread_create(&thread_main, NULL, (void *)thread_reactor_fn,
+				(void *)&dummy);
+	else
+		pthread_create(&thread_main, NULL, (void *)thread_main_fn,
+				(void *)&dummy);
+
+	/* Wait for listen socket to be bound */
+	if (hdmi_service_ready_wait() != 0) {
+		/* Stop service threads, a later init starts them again */
+		if (cmd_add(HDMI_EXIT, get_new_cmd_id_ind(), -1, 0, NULL) == 0)
+			hdmi_event(HDMIEVENT_CMD);
+		pthread_join(thread_main, NULL);
+		socket = -1;
+	} else if (flags & HDMI_INIT_CALLBACK) {
+		/* No socket, messages are delivered by the dispatcher */
+		socket = dispatch_start();
+		if (socket == 0) {
+			direct_client = SOCKET_CLIENT_CALLBACK;
+			sockclient_subscribe(direct_client,
+				(flags & HDMI_INIT_NO_RETURN_MSG) ?
+						0 : HDMI_SUBSCRIBE_ALL);
+		}
+	} else if (flags & HDMI_INIT_DIRECT) {
+		socket = serversocket_direct(flags & HDMI_INIT_REACTOR,
+							&direct_client);
+		if ((socket >= 0) && (flags & HDMI_INIT_NO_RETURN_MSG))
+			sockclient_subscribe(direct_client, 0);
+	} else {
+		socket = serversocket_create(flags & HDMI_INIT_NO_RETURN_MSG);
+	}
 
-	LOGHDMILIB("%s end", __func__);
+	LOGHDMILIB("%s end sock:%d %lldus", __func__, socket,
+			hdmi_time_us() - start);
+	return socket;
+}
 
-	/* Wait for threads to start */
-	usleep(100000);
-	socket = serversocket_create(avoid_return_msg);
+/* Send command to service with cmd_id */
+static int cmd_submit_id(__u32 cmd, __u32 cmd_id, __u32 len, __u8 *data)
+{
+	__u8 buf[CMDBUF_OFFSET + CMD_DATA_MAX];
+	struct cmd_done done;
+	__u32 mask;
 
-	return socket;
+	if (len > CMD_DATA_MAX)
+		return -1;
+
+	if (direct_client >= 0) {
+		/* In process, straight into command queue */
+		if (cmd == HDMI_SUBSCRIBE) {
+			memcpy(&mask, data, 4);
+			sockclient_subscribe(direct_client, mask);
+			done.cmd = cmd;
+			done.cmd_id = cmd_id;
+			done.client = direct_client;
+			done.queued = hdmi_time_us();
+			done.start = done.queued;
+			cmd_done_send(&done, 0);
+			return 0;
+		}
+		if (cmd_add(cmd, cmd_id, direct_client, len, data) < 0)
+			return -1;
+		hdmi_event(HDMIEVENT_CMD);
+		return 0;
+	}
+
+	memcpy(&buf[CMD_OFFSET], &cmd, 4);
+	memcpy(&buf[CMDID_OFFSET], &cmd_id, 4);
+	memcpy(&buf[CMDLEN_OFFSET], &len, 4);
+	if (len)
+		memcpy(&buf[CMDBUF_OFFSET], data, len);
+	if (serversocket_write(CMDBUF_OFFSET + len, buf) !=
+					(int)(CMDBUF_OFFSET + len))
+		return -1;
+	return 0;
 }
 
-int hdmi_service_exit(void)
+/* Commands collected between hdmi_batch_begin and hdmi_batch_submit.
+ * Each thread has its own batch.
+ */
+struct cmd_batch {
+	int nr;
+	__u32 len;
+	__u8 buf[CMD_BATCH_MAX];
+};
+
+static pthread_key_t cmd_batch_key;
+static pthread_once_t cmd_batch_once = PTHREAD_ONCE_INIT;
+
+static void cmd_batch_key_create(void)
 {
-	int val;
-	__u8 buf[32];
-	val = HDMI_EXIT;
+	pthread_key_create(&cmd_batch_key, free);
+}
 
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	/* cmd_id */
-	val = 0;
-	memcpy(&buf[CMDID_OFFSET], &val, 4);
-	/* len */
-	val = 0;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	serversocket_write(CMDBUF_OFFSET + val, buf);
+/* Batch of calling thread, NULL if none is begun */
+static struct cmd_batch *cmd_batch_get(void)
+{
+	pthread_once(&cmd_batch_once, cmd_batch_key_create);
+	return pthread_getspecific(cmd_batch_key);
+}
+
+/* Add command to batch. Returns the cmd_id, or -1 if batch is full */
+static int cmd_batch_add(struct cmd_batch *batch, __u32 cmd, __u32 len,
+								__u8 *data)
+{
+	__u8 *msg = batch->buf + batch->len;
+	int cmd_id;
+
+	if ((batch->nr == CMD_BATCH_CMDS_MAX) ||
+			(CMD_BATCH_MAX - batch->len < CMDBUF_OFFSET + len))
+		return -1;
+
+	cmd_id = get_new_cmd_id_ind();
+	memcpy(msg + CMD_OFFSET, &cmd, 4);
+	memcpy(msg + CMDID_OFFSET, &cmd_id, 4);
+	memcpy(msg + CMDLEN_OFFSET, &len, 4);
+	if (len)
+		memcpy(msg + CMDBUF_OFFSET, data, len);
+	batch->len += CMDBUF_OFFSET + len;
+	batch->nr++;
+	return cmd_id;
+}
+
+/* Send command to service with a new cmd_id, or add it to the batch of
+ * calling thread. Returns the cmd_id, or -1 if the command could not be
+ * sent.
+ */
+int cmd_submit(__u32 cmd, __u32 len, __u8 *data)
+{
+	struct cmd_batch *batch;
+	int cmd_id;
+
+	if (len > CMD_DATA_MAX)
+		return -1;
+
+	batch = cmd_batch_get();
+	if (batch)
+		return cmd_batch_add(batch, cmd, len, data);
+
+	cmd_id = get_new_cmd_id_ind();
+	if (cmd_submit_id(cmd, cmd_id, len, data) < 0)
+		return -1;
+	return cmd_id;
+}
+
+int hdmi_service_batch_begin(void)
+{
+	struct cmd_batch *batch;
+
+	if (cmd_batch_get())
+		return -1;
 
+	batch = malloc(sizeof(*batch));
+	if (batch == NULL)
+		return -1;
+	batch->nr = 0;
+	batch->len = 0;
+	if (pthread_setspecific(cmd_batch_key, batch)) {
+		free(batch);
+		return -1;
+	}
 	return 0;
 }
 
-int hdmi_service_enable(void)
+/* Send the batch of calling thread in one write.
+ * Returns the cmd_id of the batch, 0 if it was empty, or -1.
+ */
+int hdmi_service_batch_submit(void)
 {
-	int val;
-	__u8 buf[32];
-	val = HDMI_ENABLE;
+	struct cmd_batch *batch;
+	struct iovec iov[2];
+	__u8 marker[CMDBUF_OFFSET];
+	__u32 val;
+	int cmd_id = 0;
+
+	batch = cmd_batch_get();
+	if (batch == NULL)
+		return -1;
+	pthread_setspecific(cmd_batch_key, NULL);
+
+	if (batch->nr && (direct_client >= 0)) {
+		/* In process, straight into command queue */
+		cmd_id = get_new_cmd_id_ind();
+		if (cmd_decode_batch(batch->buf, batch->len, cmd_id,
+							direct_client) > 0)
+			hdmi_event(HDMIEVENT_CMD);
+		else
+			cmd_id = -1;
+	} else if (batch->nr) {
+		cmd_id = get_new_cmd_id_ind();
+		val = HDMI_BATCH;
+		memcpy(&marker[CMD_OFFSET], &val, 4);
+		memcpy(&marker[CMDID_OFFSET], &cmd_id, 4);
+		memcpy(&marker[CMDLEN_OFFSET], &batch->len, 4);
+		iov[0].iov_base = marker;
+		iov[0].iov_len = CMDBUF_OFFSET;
+		iov[1].iov_base = batch->buf;
+		iov[1].iov_len = batch->len;
+		if (serversocket_writev(iov, 2) !=
+					(int)(CMDBUF_OFFSET + batch->len))
+			cmd_id = -1;
+	}
 
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	/* cmd_id */
-	val = 0;
-	memcpy(&buf[CMDID_OFFSET], &val, 4);
-	/* len */
-	val = 0;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	serversocket_write(CMDBUF_OFFSET + val, buf);
+	free(batch);
+	return cmd_id;
+}
+
+/* Send command to service and wait at most timeout_ms for it to be
+ * handled. Returns the command result, -1 if it could not be sent or
+ * -ETIMEDOUT.
+ */
+int cmd_submit_wait(__u32 cmd, __u32 len, __u8 *data, int timeout_ms)
+{
+	int cmd_id;
+	int waiter;
 
+	/* Registered first, the command may be done before send returns */
+	cmd_id = get_new_cmd_id_ind();
+	waiter = cmd_wait_register(cmd_id);
+	if (waiter < 0)
+		return -1;
+
+	if (cmd_submit_id(cmd, cmd_id, len, data) < 0) {
+		cmd_wait_unregister(waiter);
+		return -1;
+	}
+	return cmd_wait(waiter, timeout_ms);
+}
+
+/* Send HDMI_EVENTRING with ring descriptors fds, memfd and eventfd, and
+ * wait at most timeout_ms for it to be handled.
+ */
+static int event_ring_submit(int *fds, int timeout_ms)
+{
+	__u8 buf[CMDBUF_OFFSET + 4];
+	__u32 cmd = HDMI_EVENTRING;
+	__u32 len = 4;
+	__u32 size = HDMI_EVENT_RING_SIZE;
+	int cmd_id;
+	int waiter;
+
+	if (direct_client >= 0)
+		/* In process, no descriptors to pass */
+		return sockclient_ring_attach(direct_client, fds[0], fds[1]);
+
+	cmd_id = get_new_cmd_id_ind();
+	waiter = cmd_wait_register(cmd_id);
+	if (waiter < 0)
+		return -1;
+
+	memcpy(&buf[CMD_OFFSET], &cmd, 4);
+	memcpy(&buf[CMDID_OFFSET], &cmd_id, 4);
+	memcpy(&buf[CMDLEN_OFFSET], &len, 4);
+	memcpy(&buf[CMDBUF_OFFSET], &size, 4);
+	if (serversocket_sendfds(buf, sizeof(buf), fds, 2) != sizeof(buf)) {
+		cmd_wait_unregister(waiter);
+		return -1;
+	}
+	return cmd_wait(waiter, timeout_ms);
+}
+
+int hdmi_service_event_ring_open(int timeout_ms)
+{
+	struct hdmi_event_ring *ring;
+	__u32 size = 0;
+	int fds[2];
+	int res;
+
+	if (event_ring || (direct_client == SOCKET_CLIENT_CALLBACK))
+		return -1;
+
+	ring = eventring_create(HDMI_EVENT_RING_SIZE, &fds[0], &fds[1]);
+	if (ring == NULL)
+		return -1;
+
+	res = event_ring_submit(fds, timeout_ms);
+	close(fds[0]);
+	if (res != 0) {
+		/* The service may still attach it */
+		if (res == -ETIMEDOUT)
+			cmd_submit_id(HDMI_EVENTRING, get_new_cmd_id_ind(), 4,
+							(__u8 *)&size);
+		close(fds[1]);
+		eventring_destroy(ring);
+		return res;
+	}
+
+	event_ring = ring;
+	event_ring_evfd = fds[1];
 	return 0;
 }
 
-int hdmi_service_disable(void)
+int hdmi_service_event_ring_read(__u32 *cmd, __u32 *cmd_id, __u32 *len,
+							__u8 **data)
 {
-	int val;
-	__u8 buf[32];
-	val = HDMI_DISABLE;
+	if (event_ring == NULL)
+		return 0;
+	return eventring_read(event_ring, cmd, cmd_id, len, data);
+}
 
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	/* cmd_id */
-	val = 0;
-	memcpy(&buf[CMDID_OFFSET], &val, 4);
-	/* len */
-	val = 0;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	serversocket_write(CMDBUF_OFFSET + val, buf);
+void hdmi_service_event_ring_release(void)
+{
+	if (event_ring)
+		eventring_release(event_ring);
+}
+
+int hdmi_service_event_ring_wait(int timeout_ms)
+{
+	if (event_ring == NULL)
+		return 0;
+	return eventring_wait(event_ring, event_ring_evfd, timeout_ms);
+}
+
+static void event_ring_free(void)
+{
+	eventring_destroy(event_ring);
+	close(event_ring_evfd);
+	event_ring = NULL;
+	event_ring_evfd = -1;
+}
+
+int hdmi_service_event_ring_close(int timeout_ms)
+{
+	__u32 size = 0;
+	int res;
+
+	if (event_ring == NULL)
+		return 0;
 
+	/* Back to the socket before the ring is unmapped */
+	if (direct_client >= 0)
+		res = sockclient_ring_attach(direct_client, -1, -1);
+	else
+		res = cmd_submit_wait(HDMI_EVENTRING, 4, (__u8 *)&size,
+							timeout_ms);
+	event_ring_free();
+	return res;
+}
+
+int hdmi_service_exit(void)
+{
+	long long start = hdmi_time_us();
+
+	/* Never batched */
+	if (cmd_submit_id(HDMI_EXIT, get_new_cmd_id_ind(), 0, NULL) < 0)
+		return -1;
+
+	/* Wait for service threads to exit */
+	if (!pthread_equal(pthread_self(), thread_main))
+		pthread_join(thread_main, NULL);
+	serversocket_close();
+	sockclient_subscribe(SOCKET_CLIENT_CALLBACK, 0);
+	dispatch_stop();
+	if (event_ring)
+		event_ring_free();
+
+	LOGHDMILIB("%s end %lldus", __func__, hdmi_time_us() - start);
 	return 0;
 }
 
-#ifdef HDMI_SERVICE_USE_CALLBACK_FN
+int hdmi_service_enable(void)
+{
+	return cmd_submit(HDMI_ENABLE, 0, NULL);
+}
+
+int hdmi_service_disable(void)
+{
+	return cmd_submit(HDMI_DISABLE, 0, NULL);
+}
+
 void hdmi_service_callback_set(cb_fn hdmi_cb)
 {
-	hdmi_callback_fn = hdmi_cb;
+	dispatch_callback_set(hdmi_cb);
 }
 
 cb_fn hdmi_service_callback_get(void)
 {
-	return hdmi_callback_fn;
+	return dispatch_callback_get();
 }
-#endif /*HDMI_SERVICE_USE_CALLBACK_FN*/
 
 int hdmi_service_resolution_set(int cea, int vesaceanr)
 {
-	int val;
-	__u8 buf[32];
-
-	val = HDMI_FB_RES_SET;
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	/* cmd_id */
-	val = 0;
-	memcpy(&buf[CMDID_OFFSET], &val, 4);
-	/* len */
-	val = 2;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	/* data */
-	buf[CMDBUF_OFFSET] = cea;
-	buf[CMDBUF_OFFSET + 1] = vesaceanr;
-	serversocket_write(CMDBUF_OFFSET + val, buf);
+	__u8 data[2];
 
-	return 0;
+	data[0] = cea;
+	data[1] = vesaceanr;
+	return cmd_submit(HDMI_FB_RES_SET, 2, data);
 }
 
-int hdmi_service_fb_release(void)
+int hdmi_service_resolution_set_sync(int cea, int vesaceanr, int timeout_ms)
 {
-	int val;
-	__u8 buf[32];
+	__u8 data[2];
 
-	val = HDMI_FB_RELEASE;
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	/* cmd_id */
-	val = 0;
-	memcpy(&buf[CMDID_OFFSET], &val, 4);
-	/* len */
-	val = 0;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	serversocket_write(CMDBUF_OFFSET + val, buf);
+	data[0] = cea;
+	data[1] = vesaceanr;
+	return cmd_submit_wait(HDMI_FB_RES_SET, 2, data, timeout_ms);
+}
 
-	return 0;
+int hdmi_service_fb_release(void)
+{
+	return cmd_submit(HDMI_FB_RELEASE, 0, NULL);
 }
 
 int hdmi_service_cec_send(__u8 initiator, __u8 destination, __u8 data_size,
 							__u8 *data)
 {
-	int val;
 	__u8 buf[32];
 
 	if (data_size > CEC_MSG_SIZE_MAX)
 		return -1;
 
-	val = HDMI_CECSEND;
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	/* cmd_id */
-	val = 0;
-	memcpy(&buf[CMDID_OFFSET], &val, 4);
-	/* len */
-	val = data_size + 3;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	/* data */
-	buf[CMDBUF_OFFSET] = initiator;
-	buf[CMDBUF_OFFSET + 1] = destination;
-	buf[CMDBUF_OFFSET + 2] = data_size;
-	memcpy(&buf[CMDBUF_OFFSET + 3], data, data_size);
-	serversocket_write(CMDBUF_OFFSET + val, buf);
-
-	return 0;
+	buf[0] = initiator;
+	buf[1] = destination;
+	buf[2] = data_size;
+	memcpy(&buf[3], data, data_size);
+	return cmd_submit(HDMI_CECSEND, data_size + 3, buf);
 }
 
 int hdmi_service_edid_request(__u8 block)
 {
-	int val;
-	__u8 buf[32];
-
-	if (block >= 2)
+	if (block >= EDID_BLOCKS_MAX)
 		return -1;
 
-	val = HDMI_EDIDREQ;
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	/* cmd_id */
-	val = 0;
-	memcpy(&buf[CMDID_OFFSET], &val, 4);
-	/* len */
-	val = 1;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	/* data */
-	buf[CMDBUF_OFFSET] = block;
-	serversocket_write(CMDBUF_OFFSET + val, buf);
+	return cmd_submit(HDMI_EDIDREQ, 1, &block);
+}
 
-	return 0;
+int hdmi_service_edid_request_sync(__u8 block, int timeout_ms)
+{
+	if (block >= EDID_BLOCKS_MAX)
+		return -1;
+
+	return cmd_submit_wait(HDMI_EDIDREQ, 1, &block, timeout_ms);
 }
 
 int hdmi_service_hdcp_init(__u16 aes_size, __u8 *aes_data)
 {
-	int val;
-	__u8 buf[AES_KEYS_SIZE + CMDBUF_OFFSET];
-
 	if (aes_size != AES_KEYS_SIZE)
 		return -1;
 
-	val = HDMI_HDCP_INIT;
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	/* cmd_id */
-	val = 0;
-	memcpy(&buf[CMDID_OFFSET], &val, 4);
-	/* len */
-	val = aes_size;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	/* data */
-	memcpy(&buf[CMDBUF_OFFSET], aes_data, aes_size);
-	serversocket_write(CMDBUF_OFFSET + val, buf);
+	return cmd_submit(HDMI_HDCP_INIT, aes_size, aes_data);
+}
 
-	return 0;
+int hdmi_service_hdcp_init_sync(__u16 aes_size, __u8 *aes_data,
+							int timeout_ms)
+{
+	if (aes_size != AES_KEYS_SIZE)
+		return -1;
+
+	return cmd_submit_wait(HDMI_HDCP_INIT, aes_size, aes_data,
+							timeout_ms);
 }
 
 int hdmi_service_infoframe_send(__u8 type, __u8 version, __u8 crc,
 						__u8 data_size, __u8 *data)
 {
-	int val;
 	__u8 buf[300];
 
 	if (data_size > INFOFR_MSG_SIZE_MAX)
 		return -1;
 
-	val = HDMI_INFOFR;
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	/* cmd_id */
-	val = 0;
-	memcpy(&buf[CMDID_OFFSET], &val, 4);
-	/* len */
-	val = data_size + 4;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	/* data */
-	buf[CMDBUF_OFFSET] = type;
-	buf[CMDBUF_OFFSET + 1] = version;
-	buf[CMDBUF_OFFSET + 2] = crc;
-	buf[CMDBUF_OFFSET + 3] = data_size;
-	memcpy(&buf[CMDBUF_OFFSET + 4], data, data_size);
-	serversocket_write(CMDBUF_OFFSET + val, buf);
-
-	return 0;
+	buf[0] = type;
+	buf[1] = version;
+	buf[2] = crc;
+	buf[3] = data_size;
+	memcpy(&buf[4], data, data_size);
+	return cmd_submit(HDMI_INFOFR, data_size + 4, buf);
 }
 
 int hdmi_service_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 				__u8 vesa_cea2, __u8 nr2,
 				__u8 vesa_cea3, __u8 nr3)
 {
-	int val;
-	__u8 buf[32];
+	__u8 buf[7];
+
+	buf[0] = 3;
+	buf[1] = vesa_cea1;
+	buf[2] = nr1;
+	buf[3] = vesa_cea2;
+	buf[4] = nr2;
+	buf[5] = vesa_cea3;
+	buf[6] = nr3;
+	return cmd_submit(HDMI_VESACEAPRIO_SET, 7, buf);
+}
 
-	val = HDMI_VESACEAPRIO_SET;
-	memcpy(&buf[CMD_OFFSET], &val, 4);
-	/* cmd_id */
-	val = 0;
-	memcpy(&buf[CMDID_OFFSET], &val, 4);
-	/* len */
-	val = 7;
-	memcpy(&buf[CMDLEN_OFFSET], &val, 4);
-	/* data */
-	buf[CMDBUF_OFFSET] = 3;
-	buf[CMDBUF_OFFSET + 1] = vesa_cea1;
-	buf[CMDBUF_OFFSET + 2] = nr1;
-	buf[CMDBUF_OFFSET + 3] = vesa_cea2;
-	buf[CMDBUF_OFFSET + 4] = nr2;
-	buf[CMDBUF_OFFSET + 5] = vesa_cea3;
-	buf[CMDBUF_OFFSET + 6] = nr3;
-	serversocket_write(CMDBUF_OFFSET + val, buf);
+int hdmi_service_stats_request(void)
+{
+	return cmd_submit(HDMI_STATSREQ, 0, NULL);
+}
 
-	return 0;
+int hdmi_service_subscribe(__u32 mask)
+{
+	int cmd_id;
+
+	/* Never batched */
+	cmd_id = get_new_cmd_id_ind();
+	if (cmd_submit_id(HDMI_SUBSCRIBE, cmd_id, 4, (__u8 *)&mask) < 0)
+		return -1;
+	return cmd_id;
 }
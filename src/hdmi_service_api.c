@@ -38,12 +38,12 @@
 #include "../include/hdmi_service_local.h"
 
 /* API functions
- * Input avoid_return_msg: set to 1 to avoid messages from service.
+ * Input flags: HDMI_INIT_* flags. 1 avoids messages from service.
  * Return value: socket number where events will be notified.
  */
-int hdmi_init(int avoid_return_msg)
+int hdmi_init(int flags)
 {
-	return hdmi_service_init(avoid_return_msg);
+	return hdmi_service_init(flags);
 }
 
 int hdmi_exit(void)
@@ -61,18 +61,31 @@ int hdmi_disable(void)
 	return hdmi_service_disable();
 }
 
-#ifdef HDMI_SERVICE_USE_CALLBACK_FN
 void hdmi_callback_set(void (*hdmi_cb)(int cmd, int data_size, __u8 *data))
 {
 	hdmi_service_callback_set(hdmi_cb);
 }
-#endif /*HDMI_SERVICE_USE_CALLBACK_FN*/
 
 int hdmi_resolution_set(int cea, int vesaceanr)
 {
 	return hdmi_service_resolution_set(cea, vesaceanr);
 }
 
+int hdmi_resolution_set_sync(int cea, int vesaceanr, int timeout_ms)
+{
+	return hdmi_service_resolution_set_sync(cea, vesaceanr, timeout_ms);
+}
+
+int hdmi_edid_request_sync(__u8 block, int timeout_ms)
+{
+	return hdmi_service_edid_request_sync(block, timeout_ms);
+}
+
+int hdmi_hdcp_init_sync(__u16 aes_size, __u8 *aes_data, int timeout_ms)
+{
+	return hdmi_service_hdcp_init_sync(aes_size, aes_data, timeout_ms);
+}
+
 int hdmi_fb_release(void)
 {
 	return hdmi_service_fb_release();
@@ -107,3 +120,49 @@ int hdmi_vesa_cea_prio_set(__u8 vesa_cea1, __u8 nr1,
 						vesa_cea2, nr2,
 						vesa_cea3, nr3);
 }
+
+int hdmi_stats_request(void)
+{
+	return hdmi_service_stats_request();
+}
+
+int hdmi_subscribe(__u32 mask)
+{
+	return hdmi_service_subscribe(mask);
+}
+
+int hdmi_batch_begin(void)
+{
+	return hdmi_service_batch_begin();
+}
+
+int hdmi_batch_submit(void)
+{
+	return hdmi_service_batch_submit();
+}
+
+int hdmi_event_ring_open(int timeout_ms)
+{
+	return hdmi_service_event_ring_open(timeout_ms);
+}
+
+int hdmi_event_ring_read(__u32 *cmd, __u32 *cmd_id, __u32 *len,
+							__u8 **data)
+{
+	return hdmi_service_event_ring_read(cmd, cmd_id, len, data);
+}
+
+void hdmi_event_ring_release(void)
+{
+	hdmi_service_event_ring_release();
+}
+
+int hdmi_event_ring_wait(int timeout_ms)
+{
+	return hdmi_service_event_ring_wait(timeout_ms);
+}
+
+int hdmi_event_ring_close(int timeout_ms)
+{
+	return hdmi_service_event_ring_close(timeout_ms);
+}
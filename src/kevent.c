@@ -36,26 +36,37 @@
 #include <time.h>
 #include <ctype.h>
 #include <sys/poll.h>
+#include <sys/eventfd.h>
 #ifdef ANDROID
 #include <utils/Log.h>
 #endif
 #include "../include/hdmi_service_api.h"
 #include "../include/hdmi_service_local.h"
 
-static int hdmieventfile_open(struct pollfd *pollfds)
+static pthread_t thread_kevent;
+static int kevent_stopfd = -1;
+
+int hdmieventfile_fd_open(void)
 {
+	int fd;
 
-	pollfds->fd = open(EVENT_FILE, O_RDONLY);
-	if (pollfds->fd  < 0) {
+	fd = open(EVENT_FILE, O_RDONLY);
+	if (fd < 0)
 		LOGHDMILIB(" failed to open %s", EVENT_FILE);
+	return fd;
+}
+
+static int hdmieventfile_open(struct pollfd *pollfds)
+{
+	pollfds->fd = hdmieventfile_fd_open();
+	if (pollfds->fd  < 0)
 		return -1;
-	}
 
 	pollfds->events = POLLERR | POLLPRI;
 	return 0;
 }
 
-static int hdmieventfile_read(int fd)
+int hdmieventfile_read(int fd)
 {
 	int read_res;
 	char buf[128];
@@ -81,7 +92,7 @@ static int hdmieventfile_poll(struct pollfd *pollfds)
 	int result;
 	int timeout = -1;	/* Timeout in msec. */
 
-	result = poll(pollfds, 1, timeout);
+	result = poll(pollfds, 2, timeout);
 	switch (result) {
 	case 0:
 		LOGHDMILIB2("%s", "timeout");
@@ -101,7 +112,7 @@ static int hdmieventfile_poll(struct pollfd *pollfds)
 	return 0;
 }
 
-static int hdmieventfile_close(int fd)
+int hdmieventfile_close(int fd)
 {
 	LOGHDMILIB("%s", __func__);
 	close(fd);
@@ -110,27 +121,18 @@ static int hdmieventfile_close(int fd)
 
 int hdmievclr(__u8 mask)
 {
-	int evclrfd;
-	int ret = 0;
-
-	evclrfd = open(EVENTCLR_FILE, O_WRONLY);
-	if (evclrfd < 0) {
-		LOGHDMILIB(" failed to open %s", EVENTCLR_FILE);
-		return -1;
-	}
-	if (write(evclrfd, &mask, 1) != 1)
-		ret = -2;
-	close(evclrfd);
-	return ret;
+	if (sysfs_write(SYSFS_EVCLR, &mask, 1) != 1)
+		return -2;
+	return 0;
 }
 
 /*
  * Reading of kernel events
  */
-void thread_kevent_fn(void *arg)
+static void thread_kevent_fn(void *arg)
 {
 	int event;
-	struct pollfd pollfds;
+	struct pollfd pollfds[2];
 
 	LOGHDMILIB("%s begin", __func__);
 
@@ -140,21 +142,29 @@ void thread_kevent_fn(void *arg)
 	 */
 
 	/* Open the event file */
-	hdmieventfile_open(&pollfds);
+	hdmieventfile_open(&pollfds[0]);
+
+	/* Stop request from kevent_thread_stop */
+	pollfds[1].fd = kevent_stopfd;
+	pollfds[1].events = POLLIN;
+	pollfds[1].revents = 0;
 
 	while (1) {
 		/* Read poll event file */
-		event = hdmieventfile_read(pollfds.fd);
+		event = hdmieventfile_read(pollfds[0].fd);
 		LOGHDMILIB("kevent:%x", event);
 
 		if (event == HDMIEVENT_POLLSIZEFAIL) {
-			usleep(100000);
+			/* Wait before retry, unless stopped */
+			if ((poll(&pollfds[1], 1, 100) > 0) &&
+					(pollfds[1].revents & POLLIN))
+				break;
 
 			/* Close event file */
-			hdmieventfile_close(pollfds.fd);
+			hdmieventfile_close(pollfds[0].fd);
 
 			/* Open the event file */
-			hdmieventfile_open(&pollfds);
+			hdmieventfile_open(&pollfds[0]);
 
 		} else {
 			/* Signal main thread */
@@ -166,17 +176,46 @@ void thread_kevent_fn(void *arg)
 		}
 
 		/* Poll plug event file */
-		hdmieventfile_poll(&pollfds);
+		pollfds[1].revents = 0;
+		hdmieventfile_poll(pollfds);
+		if (pollfds[1].revents & POLLIN)
+			break;
 	}
 
 	/* Clear events */
 	hdmievclr(EVENTMASK_ALL);
 
 	/* Close event file */
-	hdmieventfile_close(pollfds.fd);
+	hdmieventfile_close(pollfds[0].fd);
 
 	LOGHDMILIB("%s end", __func__);
 
 	/* Exit thread */
 	pthread_exit(NULL);
 }
+
+/* Create kernel event thread */
+int kevent_thread_start(void)
+{
+	int dummy = 0;
+
+	kevent_stopfd = eventfd(0, 0);
+	if (kevent_stopfd < 0)
+		LOGHDMILIB("%s eventfd fail", __func__);
+
+	return pthread_create(&thread_kevent, NULL, (void *)thread_kevent_fn,
+				(void *)&dummy);
+}
+
+/* Stop kernel event thread and wait for it to exit */
+void kevent_thread_stop(void)
+{
+	__u64 val = 1;
+
+	if (write(kevent_stopfd, &val, sizeof(val)) != sizeof(val))
+		LOGHDMILIB("%s write fail", __func__);
+	pthread_join(thread_kevent, NULL);
+
+	close(kevent_stopfd);
+	kevent_stopfd = -1;
+}
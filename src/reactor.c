@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * Author: Per Persson per.xb.persson@stericsson.com for
+ * ST-Ericsson.
+ *
+ * License terms:
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <unistd.h>     /* Symbolic Constants */
+#include <sys/types.h>  /* Primitive System Data Types */
+#include <linux/types.h>
+#include <errno.h>      /* Errors */
+#include <stdarg.h>
+#include <stdio.h>      /* Input/Output */
+#include <stdlib.h>     /* General Utilities */
+#include <pthread.h>    /* POSIX Threads */
+#include <string.h>     /* String handling */
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#ifdef ANDROID
+#include <utils/Log.h>
+#endif
+#include "../include/hdmi_service_api.h"
+#include "../include/hdmi_service_local.h"
+
+/*
+ * Reactor mode.
+ * One thread waits with epoll on the kernel event file, the listen socket,
+ * all client sockets and an eventfd used by hdmi_event, and calls the
+ * handlers directly. No kevent, listen or client threads are created.
+ */
+
+/* epoll data identifying the event source */
+#define REACTOR_KEVENT		0
+#define REACTOR_WAKEUP		1
+#define REACTOR_LISTEN		2
+#define REACTOR_CLIENT		3	/* + client index */
+
+struct reactor_client {
+	int sock;
+	int out;	/* Waiting for socket to become writable */
+	struct cmd_decoder dec;
+};
+
+static struct reactor_client reactor_clients[SOCKET_CLIENTS_MAX];
+static int reactor_epfd = -1;
+static int reactor_evfd = -1;
+
+/* Wake up reactor thread to take events signalled with hdmi_event */
+void reactor_wakeup(void)
+{
+	__u64 val = 1;
+	int evfd = reactor_evfd;
+
+	if (evfd >= 0)
+		if (write(evfd, &val, sizeof(val)) != sizeof(val))
+			LOGHDMILIB("%s failed", __func__);
+}
+
+static int reactor_add(int fd, __u32 events, __u32 src)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u32 = src;
+	if (epoll_ctl(reactor_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		LOGHDMILIB("%s fd:%d err:%d", __func__, fd, errno);
+		return -1;
+	}
+	return 0;
+}
+
+/* Wait for writable client sockets while they have queued messages */
+static void reactor_clients_out(void)
+{
+	struct epoll_event ev;
+	struct reactor_client *cli;
+	int index;
+	int out;
+
+	for (index = 0; index < SOCKET_CLIENTS_MAX; index++) {
+		cli = &reactor_clients[index];
+		if (cli->sock < 0)
+			continue;
+		out = sockclient_pending(index) > 0;
+		if (out == cli->out)
+			continue;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = out ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+		ev.data.u32 = REACTOR_CLIENT + index;
+		if (epoll_ctl(reactor_epfd, EPOLL_CTL_MOD, cli->sock, &ev) < 0)
+			LOGHDMILIB("%s sock:%d err:%d", __func__, cli->sock,
+									errno);
+		else
+			cli->out = out;
+	}
+}
+
+static void reactor_client_close(struct reactor_client *cli)
+{
+	LOGHDMILIB("clisocket closed:%d", cli->sock);
+
+	epoll_ctl(reactor_epfd, EPOLL_CTL_DEL, cli->sock, NULL);
+	cmd_decoder_exit(&cli->dec);
+	sockclient_unregister(cli - reactor_clients);
+	cli->sock = -1;
+}
+
+/* Serve client socket sock. May be called from another thread once the
+ * reactor is ready. Returns the client index, or -1.
+ */
+int reactor_client_add(int sock)
+{
+	int index;
+
+	/* Same index in client table and reactor_clients */
+	index = sockclient_register(sock);
+	if (index < 0) {
+		LOGHDMILIB("%s no room for sock:%d", __func__, sock);
+		close(sock);
+		return -1;
+	}
+
+	reactor_clients[index].out = 0;
+	cmd_decoder_init(&reactor_clients[index].dec);
+	reactor_clients[index].sock = sock;
+	if (reactor_add(sock, EPOLLIN, REACTOR_CLIENT + index) < 0) {
+		reactor_clients[index].sock = -1;
+		sockclient_unregister(index);
+		return -1;
+	}
+	return index;
+}
+
+static void reactor_accept(int sockl)
+{
+	struct sockaddr_un cli_addr;
+	socklen_t clilen;
+	int socknew;
+
+	clilen = sizeof(cli_addr);
+	socknew = accept(sockl, (struct sockaddr *) &cli_addr, &clilen);
+	if (socknew < 0) {
+		LOGHDMILIB("socket accept fail:%d", socknew);
+		return;
+	}
+	LOGHDMILIB2("socket accept:%d", socknew);
+
+	reactor_client_add(socknew);
+}
+
+/* Read commands from client socket into command queue and handle them.
+ * Returns HDMI_EXIT if an exit command was handled, -1 if socket closed.
+ */
+static int reactor_client_read(struct reactor_client *cli)
+{
+	int res;
+
+	res = cmd_decode(&cli->dec, cli->sock, cli - reactor_clients);
+	if (res < 0)
+		return -1;
+	if (res == 0)
+		return 0;
+
+	hdmi_event_queue(HDMIEVENT_CMD);
+	return hdmi_events_handle();
+}
+
+/* Reactor thread. Replaces main, kevent, listen and client threads */
+void thread_reactor_fn(void *arg)
+{
+	struct epoll_event events[REACTOR_EVENTS_MAX];
+	struct reactor_client *cli;
+	int keventfd;
+	int sockl;
+	int cont = 1;
+	int event;
+	int nr;
+	int index;
+	__u32 src;
+	__u64 val;
+
+	LOGHDMILIB("%s begin", __func__);
+
+	for (index = 0; index < SOCKET_CLIENTS_MAX; index++)
+		reactor_clients[index].sock = -1;
+
+	reactor_epfd = epoll_create(REACTOR_EVENTS_MAX);
+	if (reactor_epfd < 0) {
+		LOGHDMILIB("%s epoll create fail", __func__);
+		hdmi_service_ready(0);
+		goto thread_reactor_fn_end;
+	}
+
+	/* Events signalled with hdmi_event */
+	reactor_evfd = eventfd(0, EFD_NONBLOCK);
+	if (reactor_evfd >= 0)
+		reactor_add(reactor_evfd, EPOLLIN, REACTOR_WAKEUP);
+
+	/*
+	 * Kernel events. Read once to arm the notification.
+	 * Note: events are subscribed at call to api function hdmi_enable
+	 * Until then no events will occur.
+	 */
+	keventfd = hdmieventfile_fd_open();
+	if (keventfd >= 0) {
+		hdmieventfile_read(keventfd);
+		reactor_add(keventfd, EPOLLPRI | EPOLLERR, REACTOR_KEVENT);
+	}
+
+	sockl = listensocket_create();
+	if (sockl >= 0)
+		reactor_add(sockl, EPOLLIN, REACTOR_LISTEN);
+
+	/* Service can now be connected to */
+	hdmi_service_ready(sockl >= 0);
+
+	while (cont) {
+		nr = epoll_wait(reactor_epfd, events, REACTOR_EVENTS_MAX,
+				hdmi_timeout_get());
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			LOGHDMILIB("%s epoll_wait err:%d", __func__, errno);
+			break;
+		}
+
+		hdmi_timers_run();
+
+		for (index = 0; cont && (index < nr); index++) {
+			src = events[index].data.u32;
+			switch (src) {
+			case REACTOR_KEVENT:
+				event = hdmieventfile_read(keventfd);
+				LOGHDMILIB("kevent:%x", event);
+				if (event == HDMIEVENT_POLLSIZEFAIL) {
+					/* Reopen the event file */
+					epoll_ctl(reactor_epfd, EPOLL_CTL_DEL,
+							keventfd, NULL);
+					hdmieventfile_close(keventfd);
+					keventfd = hdmieventfile_fd_open();
+					if (keventfd >= 0)
+						reactor_add(keventfd,
+							EPOLLPRI | EPOLLERR,
+							REACTOR_KEVENT);
+				} else if (event > 0) {
+					hdmi_event_queue(event &
+							~HDMIEVENT_WAKEUP);
+					if (hdmi_events_handle() == HDMI_EXIT)
+						cont = 0;
+				}
+				break;
+
+			case REACTOR_WAKEUP:
+				if (read(reactor_evfd, &val, sizeof(val)) < 0)
+					break;
+				if (hdmi_events_handle() == HDMI_EXIT)
+					cont = 0;
+				break;
+
+			case REACTOR_LISTEN:
+				reactor_accept(sockl);
+				break;
+
+			default:
+				cli = &reactor_clients[src - REACTOR_CLIENT];
+				if (cli->sock < 0)
+					break;
+				if (events[index].events & EPOLLOUT)
+					sockclient_flush(cli - reactor_clients);
+				if (!(events[index].events &
+						(EPOLLIN | EPOLLHUP | EPOLLERR)))
+					break;
+				switch (reactor_client_read(cli)) {
+				case HDMI_EXIT:
+					cont = 0;
+					break;
+				case -1:
+					reactor_client_close(cli);
+					break;
+				default:
+					break;
+				}
+				break;
+			}
+		}
+
+		reactor_clients_out();
+	}
+
+	/* Clear events */
+	hdmievclr(EVENTMASK_ALL);
+	if (keventfd >= 0)
+		hdmieventfile_close(keventfd);
+
+	for (index = 0; index < SOCKET_CLIENTS_MAX; index++)
+		if (reactor_clients[index].sock >= 0)
+			reactor_client_close(&reactor_clients[index]);
+
+	if (sockl >= 0) {
+		listensocket_set(-1);
+		close(sockl);
+		/* Remove any old path */
+		unlink(SOCKET_LISTEN_PATH);
+	}
+
+	if (reactor_evfd >= 0) {
+		index = reactor_evfd;
+		reactor_evfd = -1;
+		close(index);
+	}
+	close(reactor_epfd);
+	reactor_epfd = -1;
+
+thread_reactor_fn_end:
+	hdmi_events_clear();
+	hdmi_service_exit_do();
+
+	LOGHDMILIB("%s end", __func__);
+
+	/* Exit thread */
+	pthread_exit(NULL);
+}
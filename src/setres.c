@@ -46,60 +46,156 @@
 struct vesacea vesaceaprio[CEAPRIO_MAX_SIZE];
 
 /*
- * During edid_parse, sink_support will be filled in.
- * The first format in this list with sink_support set will be chosen.
+ * Formats supported by hw, in kernel order. sink_support and prio are
+ * a view of formats_supported and vesaceaprio, kept for the format list
+ * users; format selection uses the bitmaps below.
  */
 int video_formats_nr;
 struct video_format video_formats[FORMATS_MAX];
 
+/* Formats supported by hw, by sink and by both */
+static struct vesacea_set formats_hw;
+static struct vesacea_set formats_sink;
+static struct vesacea_set formats_supported;
+
+/* Native formats of the sink, chosen unless vesaceaprio is set by client */
+static struct vesacea_set formats_native;
+static int vesaceaprio_explicit;
+
+void vesacea_set_add(struct vesacea_set *set, __u8 cea, __u8 nr)
+{
+	if (nr >= VESACEA_NR_MAX)
+		return;
+	set->map[!!cea][nr / 64] |= 1ULL << (nr % 64);
+}
+
+int vesacea_set_test(struct vesacea_set *set, __u8 cea, __u8 nr)
+{
+	if (nr >= VESACEA_NR_MAX)
+		return 0;
+	return !!(set->map[!!cea][nr / 64] & (1ULL << (nr % 64)));
+}
+
+void vesacea_set_add_set(struct vesacea_set *set, struct vesacea_set *add)
+{
+	int cea;
+	int word;
+
+	for (cea = 0; cea <= 1; cea++)
+		for (word = 0; word < VESACEA_MAP_WORDS; word++)
+			set->map[cea][word] |= add->map[cea][word];
+}
+
+/* Highest format nr in map, 0 if map is empty */
+static int vesacea_map_last(__u64 *map)
+{
+	int word;
+
+	for (word = VESACEA_MAP_WORDS - 1; word >= 0; word--)
+		if (map[word])
+			return word * 64 + 63 - __builtin_clzll(map[word]);
+	return 0;
+}
+
 int video_formats_clear(void)
 {
 	memset(video_formats, 0, sizeof(video_formats));
+	memset(&formats_hw, 0, sizeof(formats_hw));
+	memset(&formats_sink, 0, sizeof(formats_sink));
+	memset(&formats_supported, 0, sizeof(formats_supported));
+	memset(&formats_native, 0, sizeof(formats_native));
 	return 0;
 }
 
+/* List formats supported by both hw and sink, VESA before CEA */
 int vesacea_supported(int *nr, struct vesacea vesacea[])
 {
-	int index;
+	int cea;
+	int word;
+	__u64 bits;
 
 	*nr = 0;
 	LOGHDMILIB2("%s begin", __func__);
-	for (index = 0; index < FORMATS_MAX; index++) {
-		if (video_formats[index].sink_support) {
-			vesacea[*nr].cea = video_formats[index].cea;
-			vesacea[*nr].nr = video_formats[index].vesaceanr;
-			LOGHDMILIB2("cea:%d nr:%d", vesacea[*nr].cea,
+	for (cea = 0; cea <= 1; cea++)
+		for (word = 0; word < VESACEA_MAP_WORDS; word++) {
+			bits = formats_supported.map[cea][word];
+			while (bits && (*nr < FORMATS_MAX)) {
+				vesacea[*nr].cea = cea;
+				vesacea[*nr].nr = word * 64 +
+							__builtin_ctzll(bits);
+				LOGHDMILIB2("cea:%d nr:%d", vesacea[*nr].cea,
 							vesacea[*nr].nr);
-			(*nr)++;
+				(*nr)++;
+				bits &= bits - 1;
+			}
 		}
-	}
 	LOGHDMILIB2("%s end", __func__);
 	return 0;
 }
 
+/* Returns 1 if format is supported by both hw and sink */
+int video_format_supported(__u8 cea, __u8 vesaceanr)
+{
+	return vesacea_set_test(&formats_supported, cea, vesaceanr);
+}
+
+/* Set sink supported formats, and sink_support of hw formats */
+void video_formats_sink_map(struct vesacea_set *sink)
+{
+	int cea;
+	int word;
+	int index;
+
+	formats_sink = *sink;
+	for (cea = 0; cea <= 1; cea++)
+		for (word = 0; word < VESACEA_MAP_WORDS; word++)
+			formats_supported.map[cea][word] =
+					formats_hw.map[cea][word] &
+					formats_sink.map[cea][word];
+
+	for (index = 0; index < video_formats_nr; index++)
+		video_formats[index].sink_support = vesacea_set_test(
+					&formats_supported,
+					video_formats[index].cea,
+					video_formats[index].vesaceanr);
+}
+
+void video_formats_native_set(struct vesacea_set *native)
+{
+	formats_native = *native;
+}
+
+/* Set sink support to the nr_supported formats in vesacea */
+int video_formats_sink_set(int nr_supported, struct vesacea vesacea[])
+{
+	struct vesacea_set sink;
+	int cnt;
+
+	memset(&sink, 0, sizeof(sink));
+	for (cnt = 0; cnt < nr_supported; cnt++)
+		vesacea_set_add(&sink, vesacea[cnt].cea, vesacea[cnt].nr);
+	video_formats_sink_map(&sink);
+	return 0;
+}
+
 int video_formats_supported_hw(void)
 {
 	int res;
 	int index;
-	int vesacea;
 	char buf[FORMATS_MAX * 2 + 1];
 
 	/* Get hw supported formats */
-	vesacea = dispdevice_file_open(VESACEAFORMATS_FILE, O_RDONLY);
-	if (vesacea < 0) {
-		LOGHDMILIB("***** Failed to open %s *****",
-					VESACEAFORMATS_FILE);
-		return -1;
-	}
-
-	res = read(vesacea, buf, sizeof(buf));
-	close(vesacea);
+	res = sysfs_read(SYSFS_VESACEAFORMATS, buf, sizeof(buf));
 	if (res <= 0) {
 		LOGHDMILIB("***** Failed to read %s *****",
 					VESACEAFORMATS_FILE);
 		return -1;
 	}
 
+	memset(&formats_hw, 0, sizeof(formats_hw));
+	memset(&formats_sink, 0, sizeof(formats_sink));
+	memset(&formats_supported, 0, sizeof(formats_supported));
+	memset(&formats_native, 0, sizeof(formats_native));
 	for (index = 0; index < FORMATS_MAX; index++) {
 		if ((index * 2 + 2) > res) {
 			/* No more to read */
@@ -113,6 +209,8 @@ int video_formats_supported_hw(void)
 		video_formats[index].vesaceanr = *(buf + index * 2 + 1);
 		video_formats[index].sink_support = 0;
 		video_formats[index].prio = VESACEAPRIO_DEFAULT;
+		vesacea_set_add(&formats_hw, video_formats[index].cea,
+					video_formats[index].vesaceanr);
 	}
 	video_formats_nr = index;
 	return 0;
@@ -128,33 +226,25 @@ struct video_format *video_formats_get(void)
 	return video_formats;
 }
 
-static int vesaceanrtovar(struct fb_var_screeninfo *var, __u8 cea,
+/* Get timing of cea and vesaceanr from the kernel */
+static int vesaceanrtovar_sysfs(struct fb_var_screeninfo *var, __u8 cea,
 				__u8 vesaceanr, __u8 num_buffers)
 {
-	int timing;
 	int res;
 	unsigned int index;
 	char buf[128];
 	int interlaced;
 
 	/* Request timing info */
-	timing = dispdevice_file_open(TIMING_FILE, O_RDWR);
-	if (timing < 0) {
-		LOGHDMILIB("***** Failed to open %s *****", TIMING_FILE);
-		return -1;
-	}
 	buf[0] = cea;
 	buf[1] = vesaceanr;
-	res = write(timing, buf, 2);
+	res = sysfs_write(SYSFS_TIMING, buf, 2);
 	if (res <= 0) {
 		LOGHDMILIB("***** Failed to write %s *****", TIMING_FILE);
-		close(timing);
 		return -1;
 	}
 
-	lseek(timing, 0, SEEK_SET);
-	res = read(timing, buf, sizeof(buf));
-	close(timing);
+	res = sysfs_read(SYSFS_TIMING, buf, sizeof(buf));
 	if (res <= 0) {
 		LOGHDMILIB("***** Failed to read %s *****", TIMING_FILE);
 		return -1;
@@ -197,8 +287,82 @@ static int vesaceanrtovar(struct fb_var_screeninfo *var, __u8 cea,
 	return -EINVAL;
 }
 
+#ifdef HDMI_SERVICE_TIMING_VERIFY
+/* Compare table timing in var with the kernel, use kernel on mismatch */
+static void vesaceanrtovar_verify(struct fb_var_screeninfo *var, __u8 cea,
+				__u8 vesaceanr, __u8 num_buffers)
+{
+	struct fb_var_screeninfo kvar = *var;
+	int pixdiff;
+
+	if (vesaceanrtovar_sysfs(&kvar, cea, vesaceanr, num_buffers))
+		return;
+
+	pixdiff = (int)kvar.pixclock - (int)var->pixclock;
+	if ((kvar.xres == var->xres) && (kvar.yres == var->yres) &&
+			(abs(pixdiff) <= (int)var->pixclock / 100) &&
+			(kvar.left_margin == var->left_margin) &&
+			(kvar.right_margin == var->right_margin) &&
+			(kvar.upper_margin == var->upper_margin) &&
+			(kvar.lower_margin == var->lower_margin) &&
+			(kvar.vmode == var->vmode))
+		return;
+
+	LOGHDMILIB("CEA %d nr %d timing mismatch, table %dx%d pix:%d "
+			"h:%d/%d v:%d/%d, kernel %dx%d pix:%d h:%d/%d v:%d/%d",
+			cea, vesaceanr,
+			var->xres, var->yres, var->pixclock,
+			var->left_margin, var->right_margin,
+			var->upper_margin, var->lower_margin,
+			kvar.xres, kvar.yres, kvar.pixclock,
+			kvar.left_margin, kvar.right_margin,
+			kvar.upper_margin, kvar.lower_margin);
+	*var = kvar;
+}
+#endif
+
+/*
+ * Fill in var from the CEA-861 and DMT timing tables. Formats not in the
+ * tables are queried from the kernel. With HDMI_SERVICE_TIMING_VERIFY
+ * defined, table timings are also checked against the kernel.
+ */
+static int vesaceanrtovar(struct fb_var_screeninfo *var, __u8 cea,
+				__u8 vesaceanr, __u8 num_buffers)
+{
+	const struct video_timing *t;
+
+	t = timing_get(cea, vesaceanr);
+	if (t == NULL) {
+		LOGHDMILIB("CEA %d nr %d not in timing table", cea, vesaceanr);
+		return vesaceanrtovar_sysfs(var, cea, vesaceanr, num_buffers);
+	}
+
+	var->xres = t->xres;
+	var->yres = t->yres;
+	var->xres_virtual = var->xres;
+	var->yres_virtual = var->yres * num_buffers;
+	var->pixclock = t->pixclock;
+	var->left_margin = t->hbp;
+	var->right_margin = t->hfp;
+	var->upper_margin = t->vbp;
+	var->lower_margin = t->vfp;
+	var->hsync_len = t->hsync;
+	var->vsync_len = t->vsync;
+	var->vmode &= ~FB_VMODE_INTERLACED;
+	var->vmode |= (t->flags & TIMING_INTERLACED) ? FB_VMODE_INTERLACED :
+						FB_VMODE_NONINTERLACED;
+	LOGHDMILIB3("%dx%d@%d pixclock:%d", var->xres, var->yres, t->refresh,
+							var->pixclock);
+#ifdef HDMI_SERVICE_TIMING_VERIFY
+	vesaceanrtovar_verify(var, cea, vesaceanr, num_buffers);
+#endif
+	LOGHDMILIB("CEA %d nr %d found\n", cea, vesaceanr);
+	return 0;
+}
+
 void vesacea_prio_default(void)
 {
+	vesaceaprio_explicit = 0;
 #ifdef STE_PLATFORM_U5500
         /* 1280x720P@60 */
         vesaceaprio[0].cea = 1;
@@ -288,65 +452,67 @@ void set_vesacea_prio_all(void)
 	}
 }
 
+/*
+ * Unless vesaceaprio is set by client, a native format of the sink
+ * supported by hw is best, cea before vesa.
+ * Otherwise the first format in vesaceaprio supported by both hw and sink
+ * is best. Without such a format, the highest ceanr, or if no cea format
+ * is supported the highest vesanr, is chosen.
+ */
 int get_best_videoformat(__u8 *cea, __u8 *vesaceanr)
 {
 	int index;
-	int nr_formats;
-	struct video_format *video_formats;
-	__u8 best_prio;
-	int best_ceanr;
-	int best_vesanr;
+	int nr;
+	int word;
+	__u64 bits;
 
 	*cea = 1;
 	*vesaceanr = VIDEO_FORMAT_DEFAULT;
 
-	nr_formats = nr_formats_get();
-	video_formats = video_formats_get();
-	best_prio = VESACEAPRIO_DEFAULT + 1;
-	best_ceanr = 0;
-	best_vesanr = 0;
-
-	/* Choose best video format */
-	for (index = 0; index < nr_formats; index++) {
-		LOGHDMILIB("test cea:%d nr:%d prio:%d",
-				video_formats[index].cea,
-				video_formats[index].vesaceanr,
-				video_formats[index].prio);
-		if (video_formats[index].sink_support == 0)
-			/* No sink support, check next format */
-			continue;
-
-		if (video_formats[index].prio < best_prio) {
-			/* Prio is best */
-			*cea = video_formats[index].cea;
-			*vesaceanr = video_formats[index].vesaceanr;
-			best_prio = video_formats[index].prio;
-		} else if (best_prio >= VESACEAPRIO_DEFAULT) {
-			/* Prio is not set; check ceanr */
-			if (video_formats[index].cea &&
-					(video_formats[index].vesaceanr >
-							best_ceanr)) {
-				/* It is the highest ceanr */
-				*cea = 1;
-				*vesaceanr = video_formats[index].vesaceanr;
-				best_ceanr = *vesaceanr;
+	if (!vesaceaprio_explicit) {
+		for (index = 1; index >= 0; index--)
+			for (word = 0; word < VESACEA_MAP_WORDS; word++) {
+				bits = formats_native.map[index][word] &
+					formats_supported.map[index][word];
+				if (bits == 0)
+					continue;
+
+				*cea = index;
+				*vesaceanr = word * 64 + __builtin_ctzll(bits);
+				LOGHDMILIB("cea:%d nr:%d native", *cea,
+								*vesaceanr);
+				return 0;
 			}
+	}
 
-			/* If no cea has been chosen, check vesa */
-			if ((best_ceanr == 0) &
-					(!video_formats[index].cea &&
-					(video_formats[index].vesaceanr >
-							best_vesanr))) {
-				/* It is the highest veasanr */
-				*cea = 0;
-				*vesaceanr = video_formats[index].vesaceanr;
-				best_vesanr = *vesaceanr;
-			}
+	for (index = 0; index < CEAPRIO_MAX_SIZE; index++) {
+		if (vesaceaprio[index].nr == 0)
+			break;
+
+		if (vesacea_set_test(&formats_supported,
+					vesaceaprio[index].cea,
+					vesaceaprio[index].nr)) {
+			*cea = !!vesaceaprio[index].cea;
+			*vesaceanr = vesaceaprio[index].nr;
+			LOGHDMILIB("cea:%d nr:%d prio:%d", *cea, *vesaceanr,
+								index + 1);
+			return 0;
 		}
-		LOGHDMILIB("cea:%d nr:%d best_prio:%d",
-					*cea, *vesaceanr, best_prio);
 	}
 
+	nr = vesacea_map_last(formats_supported.map[1]);
+	if (nr) {
+		*cea = 1;
+		*vesaceanr = nr;
+	} else {
+		nr = vesacea_map_last(formats_supported.map[0]);
+		if (nr) {
+			*cea = 0;
+			*vesaceanr = nr;
+		}
+	}
+	LOGHDMILIB("cea:%d nr:%d", *cea, *vesaceanr);
+
 	return 0;
 }
 
@@ -357,18 +523,10 @@ int hdmi_fb_chres(__u8 cea, __u8 vesaceanr)
 	char fbname[128];
 	char buf[128];
 	int read_res;
-	int disponoff;
 	__u8 num_buffers;
 
 	/* Get fb dev name */
-	disponoff = dispdevice_file_open(DISPONOFF_FILE, O_RDONLY);
-	if (disponoff < 0) {
-		LOGHDMILIB("***** Failed to open %s *****", DISPONOFF_FILE);
-		return -1;
-	}
-
-	read_res = read(disponoff, buf, sizeof(buf));
-	close(disponoff);
+	read_res = sysfs_read(SYSFS_DISPONOFF, buf, sizeof(buf));
 	if (read_res <= 0) {
 		LOGHDMILIB("***** Failed to read %s *****", DISPONOFF_FILE);
 		return -1;
@@ -414,6 +572,7 @@ int vesaceaprio_set(__u8 len, __u8 *data)
 
 	LOGHDMILIB("%s begin", __func__);
 
+	vesaceaprio_explicit = (len > 0);
 	if (len < CEAPRIO_MAX_SIZE)
 		index_last = len;
 	else
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * Author: Per Persson per.xb.persson@stericsson.com for
+ * ST-Ericsson.
+ *
+ * License terms:
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <unistd.h>     /* Symbolic Constants */
+#include <sys/types.h>  /* Primitive System Data Types */
+#include <linux/types.h>
+#include <errno.h>      /* Errors */
+#include <stdarg.h>
+#include <stdio.h>      /* Input/Output */
+#include <stdlib.h>     /* General Utilities */
+#include <string.h>     /* String handling */
+#include <stddef.h>
+#include <fcntl.h>
+#ifdef ANDROID
+#include <utils/Log.h>
+#endif
+#include "../include/hdmi_service_api.h"
+#include "../include/hdmi_service_local.h"
+
+/*
+ * Store of parsed EDID data of known sinks, kept in SINKPROFILE_FILE.
+ * A sink is identified by vendor, product and serial number of EDID block 0
+ * together with the block 0 checksum. When the table is full the least
+ * recently used profile is replaced.
+ * Only used from main thread.
+ */
+struct sinkprofile_hdr {
+	__u32 magic;
+	__u32 version;
+	__u32 size;
+	__u32 nr;
+};
+
+static struct sink_profile sinkprofiles[SINKPROFILE_MAX];
+static int sinkprofiles_nr;
+static int sinkprofiles_loaded;
+static __u32 sinkprofile_lru;
+
+static int sinkprofile_load(void)
+{
+	struct sinkprofile_hdr hdr;
+	int fd;
+	int size;
+	int index;
+
+	sinkprofiles_loaded = 1;
+	sinkprofiles_nr = 0;
+
+	fd = open(SINKPROFILE_FILE, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if ((read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) ||
+			(hdr.magic != SINKPROFILE_MAGIC) ||
+			(hdr.version != SINKPROFILE_VERSION) ||
+			(hdr.size != sizeof(struct sink_profile)) ||
+			(hdr.nr > SINKPROFILE_MAX)) {
+		LOGHDMILIB("%s: ignore invalid %s", __func__,
+						SINKPROFILE_FILE);
+		close(fd);
+		return -1;
+	}
+
+	size = hdr.nr * sizeof(struct sink_profile);
+	if (read(fd, sinkprofiles, size) != size) {
+		LOGHDMILIB("%s: short read", __func__);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	sinkprofiles_nr = hdr.nr;
+	for (index = 0; index < sinkprofiles_nr; index++) {
+		if (sinkprofiles[index].nr_supported > FORMATS_MAX)
+			sinkprofiles[index].nr_supported = FORMATS_MAX;
+		if (sinkprofiles[index].lru > sinkprofile_lru)
+			sinkprofile_lru = sinkprofiles[index].lru;
+	}
+	LOGHDMILIB("%s: %d profiles", __func__, sinkprofiles_nr);
+	return 0;
+}
+
+/* Write all profiles to a temporary file and rename it, so that a
+ * crash never leaves a partly written store.
+ */
+static int sinkprofile_save(void)
+{
+	struct sinkprofile_hdr hdr;
+	int fd;
+	int size;
+	int res = 0;
+
+	fd = open(SINKPROFILE_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		LOGHDMILIB("***** Failed to open %s *****",
+					SINKPROFILE_FILE ".tmp");
+		return -1;
+	}
+
+	hdr.magic = SINKPROFILE_MAGIC;
+	hdr.version = SINKPROFILE_VERSION;
+	hdr.size = sizeof(struct sink_profile);
+	hdr.nr = sinkprofiles_nr;
+	size = sinkprofiles_nr * sizeof(struct sink_profile);
+	if ((write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) ||
+				(write(fd, sinkprofiles, size) != size)) {
+		LOGHDMILIB("***** Failed to write %s *****",
+					SINKPROFILE_FILE ".tmp");
+		res = -2;
+	}
+	if (fsync(fd) < 0)
+		res = -3;
+	close(fd);
+
+	if ((res == 0) && (rename(SINKPROFILE_FILE ".tmp",
+						SINKPROFILE_FILE) < 0)) {
+		LOGHDMILIB("***** Failed to rename %s *****",
+					SINKPROFILE_FILE ".tmp");
+		res = -4;
+	}
+	if (res)
+		unlink(SINKPROFILE_FILE ".tmp");
+	return res;
+}
+
+/* Get profile key from EDID block 0 */
+int sinkprofile_key(__u8 *edid0, __u8 *key)
+{
+	memcpy(key, edid0 + EDID_BL0_VENDOR_OFFSET, SINKPROFILE_KEY_SIZE - 1);
+	key[SINKPROFILE_KEY_SIZE - 1] = edid0[EDID_CHKSUM_OFFSET];
+	return 0;
+}
+
+static struct sink_profile *sinkprofile_lookup(__u8 *key)
+{
+	int index;
+
+	for (index = 0; index < sinkprofiles_nr; index++)
+		if (memcmp(sinkprofiles[index].key, key,
+						SINKPROFILE_KEY_SIZE) == 0)
+			return &sinkprofiles[index];
+	return NULL;
+}
+
+/* Find profile of sink with EDID block 0 edid0. Returns NULL if unknown. */
+struct sink_profile *sinkprofile_find(__u8 *edid0)
+{
+	__u8 key[SINKPROFILE_KEY_SIZE];
+	struct sink_profile *profile;
+
+	if (!sinkprofiles_loaded)
+		sinkprofile_load();
+
+	sinkprofile_key(edid0, key);
+	profile = sinkprofile_lookup(key);
+	if (profile)
+		profile->lru = ++sinkprofile_lru;
+	LOGHDMILIB("%s: %s", __func__, profile ? "hit" : "miss");
+	return profile;
+}
+
+/* Add or update profile and write the store to file */
+int sinkprofile_store(struct sink_profile *profile)
+{
+	struct sink_profile *dest;
+	int errors_changed;
+	int index;
+
+	if (!sinkprofiles_loaded)
+		sinkprofile_load();
+
+	dest = sinkprofile_lookup(profile->key);
+	if (dest == NULL) {
+		if (sinkprofiles_nr < SINKPROFILE_MAX) {
+			dest = &sinkprofiles[sinkprofiles_nr++];
+		} else {
+			/* Replace least recently used */
+			dest = &sinkprofiles[0];
+			for (index = 1; index < sinkprofiles_nr; index++)
+				if (sinkprofiles[index].lru < dest->lru)
+					dest = &sinkprofiles[index];
+		}
+	} else if (memcmp(dest, profile,
+				offsetof(struct sink_profile, lru)) == 0) {
+		/* Unchanged profile. DDC reads alone are kept in memory and
+		 * saved with the next write, only new errors are saved now.
+		 */
+		errors_changed = (dest->ddc.read_errors !=
+						profile->ddc.read_errors) ||
+				(dest->ddc.header_errors !=
+						profile->ddc.header_errors) ||
+				(dest->ddc.chksum_errors !=
+						profile->ddc.chksum_errors);
+		dest->ddc = profile->ddc;
+		if (!errors_changed)
+			return 0;
+	}
+
+	memcpy(dest, profile, sizeof(*dest));
+	dest->lru = ++sinkprofile_lru;
+	return sinkprofile_save();
+}
+
+/* Log stored profiles */
+void sinkprofile_dump(void)
+{
+	struct sink_profile *profile;
+	int index;
+
+	for (index = 0; index < sinkprofiles_nr; index++) {
+		profile = &sinkprofiles[index];
+		LOGHDMILIB("sink %02x%02x %02x%02x hdmi:%d formats:%d "
+				"last cea:%d nr:%d",
+				profile->key[0], profile->key[1],
+				profile->key[2], profile->key[3],
+				profile->hdmi, profile->nr_supported,
+				profile->cea, profile->vesaceanr);
+		LOGHDMILIB("sink %02x%02x %02x%02x ddc reads:%u errors "
+				"read:%u header:%u chksum:%u",
+				profile->key[0], profile->key[1],
+				profile->key[2], profile->key[3],
+				profile->ddc.reads, profile->ddc.read_errors,
+				profile->ddc.header_errors,
+				profile->ddc.chksum_errors);
+	}
+}
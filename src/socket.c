@@ -37,20 +37,57 @@
 #include <ctype.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/poll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #ifdef ANDROID
 #include <utils/Log.h>
 #endif
 #include "../include/hdmi_service_api.h"
 #include "../include/hdmi_service_local.h"
 
-pthread_t thread_sockclient;
-#ifdef HDMI_SERVICE_USE_CALLBACK_FN
-pthread_t thread_sockserver;
-#endif /*HDMI_SERVICE_USE_CALLBACK_FN*/
-int clientsocket = -1;
+/*
+ * Connected clients. Each client has a mask of subscribed message types,
+ * HDMI_SUBSCRIBE_*, and messages from the service are sent to all clients
+ * subscribing to their type. The table is used in both thread and reactor
+ * mode. In thread mode each client also has a client thread.
+ *
+ * Messages are sent without blocking. What a client cannot take at once
+ * is kept in its outbound queue and sent when the socket is writable;
+ * by the client thread, woken with its eventfd, or by the reactor.
+ * A message that does not fit in the queue is dropped, and a client
+ * dropping SOCKET_DROPS_MAX messages in a row is disconnected.
+ */
+struct sockclient_outq {
+	__u8 buf[SOCKET_OUTQ_SIZE];
+	unsigned int head;
+	unsigned int len;
+	unsigned int drops;	/* Consecutive drops */
+};
+
+static pthread_t sockclient_threads[SOCKET_CLIENTS_MAX];
+static int sockclient_socks[SOCKET_CLIENTS_MAX] = {-1, -1, -1, -1};
+static int sockclient_evfds[SOCKET_CLIENTS_MAX] = {-1, -1, -1, -1};
+/* Last mask is for the callback pseudo client, SOCKET_CLIENT_CALLBACK */
+static __u32 sockclient_masks[SOCKET_CLIENTS_MAX + 1];
+static int sockclient_used[SOCKET_CLIENTS_MAX];
+static struct sockclient_outq sockclient_outqs[SOCKET_CLIENTS_MAX];
+static struct eventring *sockclient_rings[SOCKET_CLIENTS_MAX];
+static pthread_mutex_t sockclient_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int sockclient_queued;		/* Bytes queued */
+static unsigned int sockclient_drops;		/* Messages dropped */
+static unsigned int sockclient_disconnects;	/* Slow clients dropped */
 int listensocket = -1;
 int serversocket = -1;
-int no_return_msg = -1;
+/* Transport of listen socket and connections, SOCK_STREAM or
+ * SOCK_SEQPACKET. Set before the service threads are created.
+ */
+static int socket_type = SOCK_STREAM;
+
+void socket_type_set(int type)
+{
+	socket_type = type;
+}
 
 int listensocket_set(int sock)
 {
@@ -63,127 +100,743 @@ int listensocket_get(void)
 	return listensocket;
 }
 
-static int clientsocket_set(int sock)
+/* Add client with all messages subscribed.
+ * Returns client index or -1 if there is no room.
+ */
+int sockclient_register(int sock)
+{
+	int index;
+
+	pthread_mutex_lock(&sockclient_mutex);
+	for (index = 0; index < SOCKET_CLIENTS_MAX; index++)
+		if ((sockclient_socks[index] < 0) && !sockclient_used[index])
+			break;
+	if (index < SOCKET_CLIENTS_MAX) {
+		sockclient_socks[index] = sock;
+		sockclient_masks[index] = HDMI_SUBSCRIBE_ALL;
+		memset(&sockclient_outqs[index], 0,
+					sizeof(sockclient_outqs[index]));
+	} else {
+		index = -1;
+	}
+	pthread_mutex_unlock(&sockclient_mutex);
+	return index;
+}
+
+/* Remove client and close its socket */
+void sockclient_unregister(int index)
 {
-	clientsocket = sock;
+	pthread_mutex_lock(&sockclient_mutex);
+	if (sockclient_socks[index] >= 0)
+		close(sockclient_socks[index]);
+	if (sockclient_evfds[index] >= 0)
+		close(sockclient_evfds[index]);
+	sockclient_socks[index] = -1;
+	sockclient_evfds[index] = -1;
+	sockclient_masks[index] = 0;
+	sockclient_outqs[index].len = 0;
+	eventring_detach(sockclient_rings[index]);
+	sockclient_rings[index] = NULL;
+	pthread_mutex_unlock(&sockclient_mutex);
+}
+
+/* Set message types sent to client */
+int sockclient_subscribe(int index, __u32 mask)
+{
+	LOGHDMILIB("%s %d mask:%x", __func__, index, mask);
+	pthread_mutex_lock(&sockclient_mutex);
+	sockclient_masks[index] = mask & HDMI_SUBSCRIBE_ALL;
+	pthread_mutex_unlock(&sockclient_mutex);
 	return 0;
 }
 
-int clientsocket_get(void)
+/* Send messages to client through its shared memory ring, memfd and evfd,
+ * instead of its socket. memfd < 0 returns to the socket.
+ * Returns 0 or -EINVAL if the ring is not usable.
+ */
+int sockclient_ring_attach(int index, int memfd, int evfd)
 {
-	return clientsocket;
+	struct eventring *er = NULL;
+
+	if ((memfd >= 0) && (evfd >= 0)) {
+		er = eventring_attach(memfd, evfd);
+		if (er == NULL)
+			return -EINVAL;
+	} else if (memfd >= 0) {
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&sockclient_mutex);
+	eventring_detach(sockclient_rings[index]);
+	sockclient_rings[index] = er;
+	pthread_mutex_unlock(&sockclient_mutex);
+	LOGHDMILIB("%s %d ring:%d", __func__, index, er != NULL);
+	return 0;
 }
 
-/* Client socket thread. Handles incoming socket messages */
-static void thread_sockclient_fn(int *arg)
+/* Add len bytes to outbound queue. sockclient_mutex must be held. */
+static void sockclient_outq_put(struct sockclient_outq *outq, __u8 *buf,
+								int len)
+{
+	unsigned int tail;
+	unsigned int seg;
+
+	tail = (outq->head + outq->len) % SOCKET_OUTQ_SIZE;
+	seg = SOCKET_OUTQ_SIZE - tail;
+	if (seg > (unsigned int)len)
+		seg = len;
+	memcpy(outq->buf + tail, buf, seg);
+	memcpy(outq->buf, buf + seg, len - seg);
+	outq->len += len;
+	sockclient_queued += len;
+}
+
+/* Send queued messages one packet each, SOCK_SEQPACKET.
+ * sockclient_mutex must be held.
+ */
+static int sockclient_outq_flush_packets(int index)
 {
-	int bytes = 0;
-	char buffer[SOCKET_DATA_MAX];
-	struct cmd_data cmd_data;
-	int cont = 1;
+	struct sockclient_outq *outq = &sockclient_outqs[index];
+	__u8 header[CMDBUF_OFFSET];
+	struct iovec iov[2];
+	struct msghdr msg;
+	unsigned int seg;
+	__u32 data_len;
+	__u32 len;
+	int res;
+
+	while (outq->len) {
+		/* A message may wrap at the end of the queue */
+		seg = SOCKET_OUTQ_SIZE - outq->head;
+		if (seg > CMDBUF_OFFSET)
+			seg = CMDBUF_OFFSET;
+		memcpy(header, outq->buf + outq->head, seg);
+		memcpy(header + seg, outq->buf, CMDBUF_OFFSET - seg);
+		memcpy(&data_len, header + CMDLEN_OFFSET, 4);
+		len = CMDBUF_OFFSET + data_len;
+
+		seg = SOCKET_OUTQ_SIZE - outq->head;
+		if (seg > len)
+			seg = len;
+		iov[0].iov_base = outq->buf + outq->head;
+		iov[0].iov_len = seg;
+		iov[1].iov_base = outq->buf;
+		iov[1].iov_len = len - seg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = (len > seg) ? 2 : 1;
+		res = sendmsg(sockclient_socks[index], &msg,
+						MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (res < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return 0;
+			outq->len = 0;
+			return -1;
+		}
+		outq->head = (outq->head + len) % SOCKET_OUTQ_SIZE;
+		outq->len -= len;
+	}
+	outq->head = 0;
+	return 0;
+}
+
+/* Send as much as possible of the outbound queue without blocking.
+ * sockclient_mutex must be held.
+ */
+static int sockclient_outq_flush(int index)
+{
+	struct sockclient_outq *outq = &sockclient_outqs[index];
+	unsigned int seg;
+	int res;
+
+	if (socket_type == SOCK_SEQPACKET)
+		return sockclient_outq_flush_packets(index);
+
+	while (outq->len) {
+		seg = SOCKET_OUTQ_SIZE - outq->head;
+		if (seg > outq->len)
+			seg = outq->len;
+		res = send(sockclient_socks[index], outq->buf + outq->head, seg,
+						MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (res < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return 0;
+			/* Client is gone, its reader will close it */
+			outq->len = 0;
+			return -1;
+		}
+		outq->head = (outq->head + res) % SOCKET_OUTQ_SIZE;
+		outq->len -= res;
+	}
+	outq->head = 0;
+	return 0;
+}
+
+/* Send queued messages to client when its socket is writable */
+int sockclient_flush(int index)
+{
+	int res = 0;
+
+	pthread_mutex_lock(&sockclient_mutex);
+	if (sockclient_socks[index] >= 0)
+		res = sockclient_outq_flush(index);
+	pthread_mutex_unlock(&sockclient_mutex);
+	return res;
+}
+
+/* Number of bytes waiting to be sent to client */
+int sockclient_pending(int index)
+{
+	int len;
+
+	pthread_mutex_lock(&sockclient_mutex);
+	len = sockclient_outqs[index].len;
+	pthread_mutex_unlock(&sockclient_mutex);
+	return len;
+}
+
+/* Send message to one client without blocking. sockclient_mutex must be
+ * held. Returns -1 if the message was dropped.
+ */
+static int sockclient_send(int index, __u8 *buf, int len)
+{
+	struct sockclient_outq *outq = &sockclient_outqs[index];
+	__u64 val = 1;
+	int sent = 0;
+
+	if (sockclient_rings[index]) {
+		if (eventring_put(sockclient_rings[index], buf, len) == 0)
+			return 0;
+		sockclient_drops++;
+		return -1;
+	}
+
+	if (outq->len == 0) {
+		sent = send(sockclient_socks[index], buf, len,
+						MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent == len)
+			return 0;
+		if (sent < 0) {
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				return -1;
+			sent = 0;
+		}
+		/* Rest of a partly sent message must follow */
+		sockclient_outq_put(outq, buf + sent, len - sent);
+		outq->drops = 0;
+		if ((sockclient_evfds[index] >= 0) &&
+				(write(sockclient_evfds[index], &val,
+						sizeof(val)) != sizeof(val)))
+			LOGHDMILIB("%s wake failed", __func__);
+		return 0;
+	}
+
+	if (SOCKET_OUTQ_SIZE - outq->len >= (unsigned int)len) {
+		sockclient_outq_put(outq, buf, len);
+		outq->drops = 0;
+		return 0;
+	}
+
+	/* Slow client */
+	sockclient_drops++;
+	LOGHDMILIB("%s sock:%d queue full, message dropped", __func__,
+						sockclient_socks[index]);
+	if (++outq->drops == SOCKET_DROPS_MAX) {
+		LOGHDMILIB("%s sock:%d too slow, disconnect", __func__,
+						sockclient_socks[index]);
+		sockclient_disconnects++;
+		/* Reader sees end of file and closes the client */
+		shutdown(sockclient_socks[index], SHUT_RDWR);
+	}
+	return -1;
+}
+
+void sockclient_stats_dump(void)
+{
+	LOGHDMILIB("clients queued bytes:%u dropped:%u disconnected:%u",
+			sockclient_queued, sockclient_drops,
+			sockclient_disconnects);
+}
+
+/* Subscription type of a message sent from service */
+static __u32 sockclient_msgtype(__u32 cmd)
+{
+	switch (cmd) {
+	case HDMI_PLUGGED_EV:
+	case HDMI_UNPLUGGED_EV:
+		return HDMI_SUBSCRIBE_PLUG;
+	case HDMI_EDIDRESP:
+		return HDMI_SUBSCRIBE_EDID;
+	case HDMI_CECRECVD:
+	case HDMI_CECSENDERR:
+		return HDMI_SUBSCRIBE_CEC;
+	case HDMI_HDCPSTATE:
+		return HDMI_SUBSCRIBE_HDCP;
+	case HDMI_STATSRESP:
+		return HDMI_SUBSCRIBE_STATS;
+	case HDMI_CMDDONE:
+		return HDMI_SUBSCRIBE_CMDDONE;
+	default:
+		return HDMI_SUBSCRIBE_STATE;
+	}
+}
+
+void cmd_decoder_init(struct cmd_decoder *dec)
+{
+	dec->bytes = 0;
+	dec->skip = 0;
+	dec->exit = 0;
+	dec->nfds = 0;
+	dec->packets = (socket_type == SOCK_SEQPACKET);
+}
+
+/* Close descriptors received but not used by a command */
+void cmd_decoder_exit(struct cmd_decoder *dec)
+{
+	while (dec->nfds)
+		close(dec->fds[--dec->nfds]);
+}
+
+/* Read from client socket, keeping descriptors passed with SCM_RIGHTS */
+static int cmd_decode_read(struct cmd_decoder *dec, int sock, int flags)
+{
+	union {
+		struct cmsghdr align;
+		__u8 buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int nfds;
+	int fd;
+	int i;
+	int res;
+
+	iov.iov_base = dec->buffer + dec->bytes;
+	iov.iov_len = sizeof(dec->buffer) - dec->bytes;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	/* With MSG_TRUNC a packet returns its full length */
+	if (dec->packets)
+		flags |= MSG_TRUNC;
+	res = recvmsg(sock, &msg, flags | MSG_CMSG_CLOEXEC);
+	if (res <= 0)
+		return res;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if ((cmsg->cmsg_level != SOL_SOCKET) ||
+				(cmsg->cmsg_type != SCM_RIGHTS))
+			continue;
+		/* Only the latest descriptors are kept */
+		cmd_decoder_exit(dec);
+		nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < nfds; i++) {
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int),
+							sizeof(int));
+			if (dec->nfds < 2)
+				dec->fds[dec->nfds++] = fd;
+			else
+				close(fd);
+		}
+	}
+	if (msg.msg_flags & MSG_CTRUNC)
+		LOGHDMILIB("%s descriptors truncated", __func__);
+	return res;
+}
+
+/* Queue the commands of a HDMI_BATCH message. The marker and the commands
+ * are added in consecutive slots, all or none, and the marker is committed
+ * last so that the whole batch is handled in one pass.
+ * Returns the number of queued commands.
+ */
+int cmd_decode_batch(__u8 *msg, __u32 len, __u32 cmd_id, int index)
+{
+	struct cmd_data *marker;
+	struct cmd_data *slot;
+	__u32 data_len;
+	__u32 cmd;
+	__u32 pos;
+	__u32 nr = 0;
+
+	/* Check the commands before anything is queued */
+	for (pos = 0; pos < len; pos += CMDBUF_OFFSET + data_len) {
+		if (len - pos < CMDBUF_OFFSET)
+			goto cmd_decode_batch_invalid;
+		memcpy(&cmd, msg + pos + CMD_OFFSET, 4);
+		memcpy(&data_len, msg + pos + CMDLEN_OFFSET, 4);
+		if ((data_len > CMD_DATA_MAX) ||
+				(len - pos - CMDBUF_OFFSET < data_len) ||
+				(cmd == HDMI_BATCH) || (cmd == HDMI_SUBSCRIBE) ||
+				(cmd == HDMI_EVENTRING) || (cmd == HDMI_EXIT) ||
+				(++nr > CMD_BATCH_CMDS_MAX))
+			goto cmd_decode_batch_invalid;
+	}
+	if (nr == 0)
+		goto cmd_decode_batch_invalid;
+
+	marker = cmd_reserve_n(nr + 1);
+	if (marker == NULL) {
+		cmd_overflow(HDMI_BATCH, cmd_id);
+		return 0;
+	}
+	marker->cmd = HDMI_BATCH;
+	marker->cmd_id = cmd_id;
+	marker->client = index;
+	marker->data_len = 4;
+	memcpy(marker->data, &nr, 4);
+
+	slot = marker;
+	for (pos = 0; pos < len; pos += CMDBUF_OFFSET + data_len) {
+		slot = cmd_next(slot);
+		memcpy(&slot->cmd, msg + pos + CMD_OFFSET, 4);
+		memcpy(&slot->cmd_id, msg + pos + CMDID_OFFSET, 4);
+		memcpy(&data_len, msg + pos + CMDLEN_OFFSET, 4);
+		slot->client = index;
+		slot->data_len = data_len;
+		memcpy(slot->data, msg + pos + CMDBUF_OFFSET, data_len);
+		cmd_commit(slot);
+	}
+	cmd_commit(marker);
+	return nr + 1;
+
+cmd_decode_batch_invalid:
+	LOGHDMILIB("%s cmd_id:%x invalid batch", __func__, cmd_id);
+	illegalstate_send(HDMI_BATCH_INVALID, cmd_id);
+	return 0;
+}
+
+/* Handle one complete message from client index. Returns number of
+ * queued commands.
+ */
+static int cmd_decode_msg(struct cmd_decoder *dec, __u8 *msg, int index)
+{
+	struct cmd_data *slot;
+	struct cmd_done done;
+	__u32 cmd;
+	__u32 cmd_id;
+	__u32 data_len;
+	__u32 mask;
+	__u32 size;
+	int res;
+
+	memcpy(&cmd, msg + CMD_OFFSET, 4);
+	memcpy(&cmd_id, msg + CMDID_OFFSET, 4);
+	memcpy(&data_len, msg + CMDLEN_OFFSET, 4);
+
+	if (cmd == HDMI_SUBSCRIBE) {
+		/* Subscription of this client */
+		mask = 0;
+		if (data_len >= 4)
+			memcpy(&mask, msg + CMDBUF_OFFSET, 4);
+		sockclient_subscribe(index, mask);
+		done.cmd = cmd;
+		done.cmd_id = cmd_id;
+		done.client = index;
+		done.queued = hdmi_time_us();
+		done.start = done.queued;
+		cmd_done_send(&done, 0);
+		return 0;
+	}
+
+	if (cmd == HDMI_EVENTRING) {
+		/* Shared memory ring of this client */
+		size = 0;
+		if (data_len >= 4)
+			memcpy(&size, msg + CMDBUF_OFFSET, 4);
+		done.cmd = cmd;
+		done.cmd_id = cmd_id;
+		done.client = index;
+		done.queued = hdmi_time_us();
+		done.start = done.queued;
+		if (size && (dec->nfds == 2))
+			/* Passed in memfd, eventfd order */
+			res = sockclient_ring_attach(index, dec->fds[0],
+								dec->fds[1]);
+		else if (size)
+			res = -EINVAL;
+		else
+			res = sockclient_ring_attach(index, -1, -1);
+		cmd_decoder_exit(dec);
+		cmd_done_send(&done, res);
+		return 0;
+	}
+
+	if (cmd == HDMI_BATCH)
+		return cmd_decode_batch(msg + CMDBUF_OFFSET, data_len, cmd_id,
+									index);
+
+	slot = cmd_alloc(cmd, cmd_id, index);
+	if (slot == NULL)
+		return 0;
+	slot->data_len = data_len;
+	memcpy(slot->data, msg + CMDBUF_OFFSET, data_len);
+	cmd_commit(slot);
+
+	if (cmd == HDMI_EXIT)
+		dec->exit = 1;
+	return 1;
+}
+
+/* SOCK_SEQPACKET transport. Each packet is one message, read with one
+ * recvmsg straight into the decoder buffer; there is nothing to
+ * reassemble. Up to SOCKET_PACKETS_MAX packets are read per call, those
+ * after the first without waiting.
+ */
+static int cmd_decode_packets(struct cmd_decoder *dec, int sock, int index)
+{
+	__u32 cmd;
+	__u32 cmd_id;
+	__u32 data_len;
+	int queued = 0;
+	int nr;
+	int res;
+
+	for (nr = 0; (nr < SOCKET_PACKETS_MAX) && !dec->exit; nr++) {
+		dec->bytes = 0;
+		res = cmd_decode_read(dec, sock, nr ? MSG_DONTWAIT : 0);
+		if (res <= 0) {
+			/* Closed is seen at next call */
+			if (nr)
+				break;
+			return -1;
+		}
+
+		if (res < CMDBUF_OFFSET) {
+			LOGHDMILIB("%s short packet:%d", __func__, res);
+			continue;
+		}
+		memcpy(&cmd, dec->buffer + CMD_OFFSET, 4);
+		memcpy(&cmd_id, dec->buffer + CMDID_OFFSET, 4);
+		memcpy(&data_len, dec->buffer + CMDLEN_OFFSET, 4);
+
+		/* res is the whole packet length, also if truncated */
+		if ((data_len > ((cmd == HDMI_BATCH) ? CMD_BATCH_MAX :
+						CMD_DATA_MAX)) ||
+				(res > (int)sizeof(dec->buffer))) {
+			LOGHDMILIB("%s cmd:%x len:%u too long", __func__, cmd,
+								data_len);
+			illegalstate_send(HDMI_CMD_TOOLONG, cmd_id);
+			continue;
+		}
+		if ((__u32)res != CMDBUF_OFFSET + data_len) {
+			LOGHDMILIB("%s cmd:%x len:%u packet:%d", __func__, cmd,
+								data_len, res);
+			continue;
+		}
+
+		queued += cmd_decode_msg(dec, dec->buffer, index);
+	}
+	dec->bytes = 0;
+	return queued;
+}
+
+/* Read from client socket and decode all complete messages in buffer.
+ * Commands are decoded straight into command queue slots. Messages longer
+ * than CMD_DATA_MAX, or CMD_BATCH_MAX for HDMI_BATCH, are skipped and
+ * reported with HDMI_CMD_TOOLONG.
+ * index is the client index, used for HDMI_SUBSCRIBE and HDMI_CMDDONE.
+ * With SOCK_SEQPACKET each packet is one message, see cmd_decode_packets.
+ * Returns number of queued commands, or -1 if the socket is closed.
+ * dec->exit is set when HDMI_EXIT is queued; the rest is then ignored.
+ */
+int cmd_decode(struct cmd_decoder *dec, int sock, int index)
+{
+	__u8 *msg;
+	__u32 cmd;
+	__u32 cmd_id;
+	__u32 data_len;
+	int pos = 0;
+	int queued = 0;
+	int res;
+
+	if (dec->packets)
+		return cmd_decode_packets(dec, sock, index);
+
+	res = cmd_decode_read(dec, sock, 0);
+	if (res <= 0)
+		return -1;
+	dec->bytes += res;
+
+	while (!dec->exit) {
+		if (dec->skip) {
+			/* Rest of an oversize message */
+			res = dec->bytes - pos;
+			if ((__u32)res > dec->skip)
+				res = dec->skip;
+			dec->skip -= res;
+			pos += res;
+			if (dec->skip)
+				break;
+		}
+
+		if (dec->bytes - pos < CMDBUF_OFFSET)
+			/* Not a complete header */
+			break;
+
+		msg = dec->buffer + pos;
+		memcpy(&cmd, msg + CMD_OFFSET, 4);
+		memcpy(&cmd_id, msg + CMDID_OFFSET, 4);
+		memcpy(&data_len, msg + CMDLEN_OFFSET, 4);
+
+		if (data_len > ((cmd == HDMI_BATCH) ? CMD_BATCH_MAX :
+							CMD_DATA_MAX)) {
+			LOGHDMILIB("%s cmd:%x len:%u too long", __func__, cmd,
+								data_len);
+			illegalstate_send(HDMI_CMD_TOOLONG, cmd_id);
+			pos += CMDBUF_OFFSET;
+			dec->skip = data_len;
+			continue;
+		}
+
+		if ((__u32)(dec->bytes - pos) < CMDBUF_OFFSET + data_len)
+			/* Not a complete message */
+			break;
+		pos += CMDBUF_OFFSET + data_len;
+
+		queued += cmd_decode_msg(dec, msg, index);
+	}
+
+	/* Keep partial message for next read */
+	dec->bytes -= pos;
+	if (dec->bytes && pos)
+		memmove(dec->buffer, dec->buffer + pos, dec->bytes);
+	return queued;
+}
+
+/* Client socket thread. Handles incoming socket messages and sends
+ * queued outgoing messages.
+ */
+static void thread_sockclient_fn(void *arg)
+{
+	struct cmd_decoder dec;
+	struct pollfd pollfds[2];
+	int index = (int)(long)arg;
 	int sock;
-	int buf_index = 0;
+	int res = 0;
+	__u64 val;
 
 	LOGHDMILIB("%s begin", __func__);
 
-	sock = *arg;
-	clientsocket_set(sock);
+	sock = sockclient_socks[index];
 	LOGHDMILIB("clisock:%d", sock);
 
-	while (cont) {
-		if (bytes < CMDBUF_OFFSET) {
-			/* Read from socket */
-			bytes += read(sock, buffer + buf_index,
-					SOCKET_DATA_MAX - buf_index);
-			if (bytes <= 0) {
-				LOGHDMILIB("clisocket closed:%d", bytes);
-				goto thread_sockclient_fn_end;
-			}
-
-			LOGHDMILIB("clisockread:%d", bytes);
+	pollfds[0].fd = sock;
+	pollfds[1].fd = sockclient_evfds[index];
+	pollfds[1].events = POLLIN;
 
-			if (bytes < CMDBUF_OFFSET)
-				/* Not enough data */
+	cmd_decoder_init(&dec);
+	while (!dec.exit) {
+		pollfds[0].events = POLLIN;
+		if (sockclient_pending(index))
+			pollfds[0].events |= POLLOUT;
+		pollfds[0].revents = 0;
+		pollfds[1].revents = 0;
+		if (poll(pollfds, 2, -1) < 0) {
+			if (errno == EINTR)
 				continue;
+			break;
 		}
 
-		/* Valid command */
-		cmd_data.cmd = (__u32)buffer[buf_index + CMD_OFFSET];
-		cmd_data.cmd_id = (__u32)buffer[buf_index + CMDID_OFFSET];
-		cmd_data.data_len = (__u32)buffer[buf_index + CMDLEN_OFFSET];
-		memcpy(cmd_data.data, &buffer[buf_index + CMDBUF_OFFSET],
-					cmd_data.data_len);
-		cmd_data.next = NULL;
-
-		/* Remaining bytes to handle */
-		bytes -= (CMDBUF_OFFSET + cmd_data.data_len);
-		buf_index += (CMDBUF_OFFSET + cmd_data.data_len);
-		if (bytes < 0)
-			bytes = 0;
-		if (bytes < CMDBUF_OFFSET) {
-			memcpy(buffer, buffer + buf_index, bytes);
-			buf_index = bytes;
-		}
+		/* Outgoing messages were queued */
+		if (pollfds[1].revents & POLLIN)
+			if (read(pollfds[1].fd, &val, sizeof(val)) < 0)
+				LOGHDMILIB("%s evfd read failed", __func__);
 
-		/* Add to list */
-		cmd_add(&cmd_data);
+		if (pollfds[0].revents & POLLOUT)
+			sockclient_flush(index);
 
-		/* Signal */
-		hdmi_event(HDMIEVENT_CMD);
+		if (!(pollfds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+			continue;
 
-		if (cmd_data.cmd == HDMI_EXIT)
-			cont = 0;
+		res = cmd_decode(&dec, sock, index);
+		if (res < 0) {
+			LOGHDMILIB("clisocket closed:%d", sock);
+			break;
+		}
+
+		/* Signal once for all commands of this read */
+		if (res > 0)
+			hdmi_event(HDMIEVENT_CMD);
 	}
 
-thread_sockclient_fn_end:
-	close(sock);
-	clientsocket_set(-1);
+	cmd_decoder_exit(&dec);
+	sockclient_unregister(index);
 
-	LOGHDMILIB("%s end: %d", __func__, bytes);
+	LOGHDMILIB("%s end: %d", __func__, res);
 	pthread_exit(NULL);
 }
 
+/* Send message to all clients subscribing to its type.
+ * Returns -1 if it could not be sent to a subscribing client.
+ */
 int clientsocket_send(__u8 *buf, int len)
 {
-	int sock;
-	int sent = -1;
-	int res = -1;
+	__u32 cmd;
+	__u32 type;
+	__u32 callback;
+	int index;
+	int res = 0;
 
-	if (no_return_msg == 1)
-		return 0;
+	memcpy(&cmd, &buf[CMD_OFFSET], 4);
+	type = sockclient_msgtype(cmd);
 
-	sock = clientsocket_get();
-	if (sock >= 0) {
-		sent = write(sock, buf, len);
-		LOGHDMILIB("%s written %d bytes on sock", __func__, sent);
+	pthread_mutex_lock(&sockclient_mutex);
+	for (index = 0; index < SOCKET_CLIENTS_MAX; index++) {
+		if ((sockclient_socks[index] < 0) ||
+				!(sockclient_masks[index] & type))
+			continue;
+		if (sockclient_send(index, buf, len) < 0)
+			res = -1;
 	}
+	callback = sockclient_masks[SOCKET_CLIENT_CALLBACK] & type;
+	pthread_mutex_unlock(&sockclient_mutex);
 
-	if (sent == len)
-		res = 0;
+	/* Application callback, outside of sockclient_mutex */
+	if (callback && (dispatch_post(buf, len) < 0))
+		res = -1;
 	return res;
 }
 
-/* Socket listen thread.
- * Creates a listen socket.
- * Listens for incoming connection.
- * At connection attempt, creates a client socket in client thread.
+/* Send message to client index if it subscribes to its type */
+int clientsocket_send_to(int index, __u8 *buf, int len)
+{
+	__u32 cmd;
+	int res = 0;
+
+	memcpy(&cmd, &buf[CMD_OFFSET], 4);
+
+	if (index == SOCKET_CLIENT_CALLBACK) {
+		if (sockclient_masks[index] & sockclient_msgtype(cmd))
+			res = dispatch_post(buf, len);
+		return res;
+	}
+
+	pthread_mutex_lock(&sockclient_mutex);
+	if ((sockclient_socks[index] >= 0) &&
+			(sockclient_masks[index] & sockclient_msgtype(cmd)))
+		res = sockclient_send(index, buf, len);
+	pthread_mutex_unlock(&sockclient_mutex);
+	return res;
+}
+
+/* Create listen socket, bind it to SOCKET_LISTEN_PATH and start listening.
+ * Returns the listen socket or -1.
  */
-void thread_socklisten_fn(void *arg)
+int listensocket_create(void)
 {
-	int socknew;
-	socklen_t clilen;
 	struct sockaddr_un serv_addr;
-	struct sockaddr_un cli_addr;
 	int res;
 	int sockl;
 
-	LOGHDMILIB("%s begin", __func__);
-
 	/* Create listen socket */
-	sockl = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockl = socket(AF_UNIX, socket_type, 0);
 	if (sockl < 0) {
 		LOGHDMILIB("%s", "socket create fail");
-		goto thread_socklisten_fn_end;
+		return -1;
 	}
 	listensocket_set(sockl);
 	LOGHDMILIB2("Listen socket create:%d", sockl);
@@ -198,21 +851,110 @@ void thread_socklisten_fn(void *arg)
 	res = bind(sockl, (struct sockaddr *) &serv_addr, sizeof(serv_addr));
 	if (res < 0) {
 		LOGHDMILIB("socket bind fail:%d", res);
-		close(sockl);
-		goto thread_socklisten_fn_end;
+		goto listensocket_create_err;
 	}
 
 	LOGHDMILIB2("Listen socket bind: %d", res);
 
-	/* while loop is breaked by shutdown on listen socket */
-	while (1) {
-		/* Listen for incoming connection */
-		if (listen(sockl, SOCKET_MAX_CONN) != 0) {
-			LOGHDMILIB("%s listen error", __func__);
-			close(sockl);
-			goto thread_socklisten_fn_end;
+	/* Listen for incoming connection */
+	if (listen(sockl, SOCKET_MAX_CONN) != 0) {
+		LOGHDMILIB("%s listen error", __func__);
+		goto listensocket_create_err;
+	}
+	return sockl;
+
+listensocket_create_err:
+	listensocket_set(-1);
+	close(sockl);
+	return -1;
+}
+
+/* Create a client thread for a new connection */
+/* Serve client socket sock with a client thread.
+ * Returns the client index, or -1.
+ */
+int sockclient_start(int sock)
+{
+	int index;
+
+	pthread_mutex_lock(&sockclient_mutex);
+	for (index = 0; index < SOCKET_CLIENTS_MAX; index++) {
+		if (sockclient_used[index] && (sockclient_socks[index] < 0)) {
+			/* Thread has ended, reuse it */
+			pthread_join(sockclient_threads[index], NULL);
+			sockclient_used[index] = 0;
+		}
+		if (!sockclient_used[index])
+			break;
+	}
+
+	if (index == SOCKET_CLIENTS_MAX) {
+		pthread_mutex_unlock(&sockclient_mutex);
+		LOGHDMILIB("%s no room for sock:%d", __func__, sock);
+		close(sock);
+		return -1;
+	}
+
+	sockclient_evfds[index] = eventfd(0, EFD_NONBLOCK);
+	if (sockclient_evfds[index] < 0) {
+		pthread_mutex_unlock(&sockclient_mutex);
+		LOGHDMILIB("%s eventfd fail for sock:%d", __func__, sock);
+		close(sock);
+		return -1;
+	}
+
+	sockclient_socks[index] = sock;
+	sockclient_masks[index] = HDMI_SUBSCRIBE_ALL;
+	memset(&sockclient_outqs[index], 0, sizeof(sockclient_outqs[index]));
+	sockclient_used[index] = 1;
+	pthread_create(&sockclient_threads[index], NULL,
+			(void *)thread_sockclient_fn, (void *)(long)index);
+	pthread_mutex_unlock(&sockclient_mutex);
+	return index;
+}
+
+/* End all client threads and wait for them to exit */
+void sockclient_stop_all(void)
+{
+	int index;
+
+	pthread_mutex_lock(&sockclient_mutex);
+	for (index = 0; index < SOCKET_CLIENTS_MAX; index++)
+		if (sockclient_socks[index] >= 0)
+			shutdown(sockclient_socks[index], SHUT_RDWR);
+	pthread_mutex_unlock(&sockclient_mutex);
+
+	for (index = 0; index < SOCKET_CLIENTS_MAX; index++) {
+		if (sockclient_used[index]) {
+			pthread_join(sockclient_threads[index], NULL);
+			sockclient_used[index] = 0;
 		}
+	}
+}
+
+/* Socket listen thread.
+ * Creates a listen socket.
+ * Listens for incoming connection.
+ * At connection attempt, creates a client socket in client thread.
+ */
+void thread_socklisten_fn(void *arg)
+{
+	int socknew;
+	socklen_t clilen;
+	struct sockaddr_un cli_addr;
+	int sockl;
+
+	LOGHDMILIB("%s begin", __func__);
 
+	sockl = listensocket_create();
+
+	/* Service can now be connected to */
+	hdmi_service_ready(sockl >= 0);
+	if (sockl < 0)
+		goto thread_socklisten_fn_end;
+
+	/* while loop is breaked by shutdown on listen socket */
+	while (1) {
 		/* Establish a client connection */
 		clilen = sizeof(cli_addr);
 		socknew = accept(sockl, (struct sockaddr *) &cli_addr, &clilen);
@@ -223,10 +965,8 @@ void thread_socklisten_fn(void *arg)
 		}
 		LOGHDMILIB2("socket accept:%d", socknew);
 
-		if (socknew >= 0)
-			/* Create a client thread */
-			pthread_create(&thread_sockclient, NULL,
-				(void *)thread_sockclient_fn, (void *)&socknew);
+		/* Create a client thread */
+		sockclient_start(socknew);
 	}
 
 thread_socklisten_fn_end:
@@ -243,58 +983,6 @@ static int serversocket_set(int sock)
 	return 0;
 }
 
-#ifdef HDMI_SERVICE_USE_CALLBACK_FN
-/* Server socket thread. Handles outgoing socket messages */
-static void thread_sockserver_fn(void *arg)
-{
-	int res;
-	char buffer[SOCKET_DATA_MAX];
-	struct cmd_data cmd_data;
-	int cont = 1;
-	int sock;
-	cb_fn callback;
-
-	LOGHDMILIB("%s begin", __func__);
-
-	sock = (int)arg;
-
-	while (cont) {
-		memset(buffer, 0, SOCKET_DATA_MAX);
-		res = read(sock, buffer, SOCKET_DATA_MAX);
-		if (res <= 0) {
-			LOGHDMILIB("servsocket closed:%d", res);
-			goto thread_sockserver_fn_end;
-		}
-
-		LOGHDMILIB("servsockread res:%d", res);
-
-		if (cmd_data.cmd == HDMI_EXIT) {
-			cont = 0;
-		} else {
-			cmd_data.cmd = (__u32)buffer[CMD_OFFSET];
-			cmd_data.cmd_id = (__u32)buffer[CMDID_OFFSET];
-			cmd_data.data_len = (__u32)buffer[CMDLEN_OFFSET];
-			memcpy(cmd_data.data, &buffer[CMDBUF_OFFSET],
-						cmd_data.data_len);
-			cmd_data.next = NULL;
-
-			/* Send through callback fn */
-			callback = hdmi_service_callback_get();
-			LOGHDMILIB("callback:%p", callback);
-			if (callback)
-				callback(cmd_data.cmd, cmd_data.data_len,
-							cmd_data.data);
-		}
-	}
-
-thread_sockserver_fn_end:
-	close(sock);
-
-	LOGHDMILIB("%s end res:%d", __func__, res);
-	pthread_exit(NULL);
-}
-#endif /*HDMI_SERVICE_USE_CALLBACK_FN*/
-
 int serversocket_create(int avoid_return_msg)
 {
 	int sock;
@@ -304,9 +992,7 @@ int serversocket_create(int avoid_return_msg)
 
 	LOGHDMILIB("%s begin", __func__);
 
-	no_return_msg = avoid_return_msg;
-
-	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	sock = socket(AF_UNIX, socket_type, 0);
 	LOGHDMILIB("sock:%d", sock);
 	if (sock < 0) {
 		LOGHDMILIB("%s %s", __func__, "socket create fail");
@@ -332,15 +1018,43 @@ serversocket_create_end:
 		serversocket_set(sock);
 		LOGHDMILIB("servsock:%d", sock);
 
-#ifdef HDMI_SERVICE_USE_CALLBACK_FN
-		/* Create a server thread */
-		pthread_create(&thread_sockserver, NULL,
-			(void *)thread_sockserver_fn, (void *)sock);
-#endif /*HDMI_SERVICE_USE_CALLBACK_FN*/
+		/* No messages to this connection */
+		if (avoid_return_msg)
+			hdmi_service_subscribe(0);
 	}
 	return sock;
 }
 
+/* Connect application to service in process through a socket pair.
+ * Commands are added directly to the command queue; the socket only
+ * carries messages from the service. Returns the application end and
+ * sets client to the client index of the service end, or returns -1.
+ */
+int serversocket_direct(int reactor, int *client)
+{
+	int socks[2];
+	int index;
+
+	if (socketpair(AF_UNIX, socket_type, 0, socks) < 0) {
+		LOGHDMILIB("%s socketpair err:%d", __func__, errno);
+		return -1;
+	}
+
+	if (reactor)
+		index = reactor_client_add(socks[1]);
+	else
+		index = sockclient_start(socks[1]);
+	if (index < 0) {
+		close(socks[0]);
+		return -1;
+	}
+
+	serversocket_set(socks[0]);
+	*client = index;
+	LOGHDMILIB("%s sock:%d client:%d", __func__, socks[0], index);
+	return socks[0];
+}
+
 static int serversocket_get(void)
 {
 	return serversocket;
@@ -352,16 +1066,68 @@ int serversocket_write(int len, __u8 *data)
 	int sock;
 
 	sock = serversocket_get();
-	n = write(sock, data, len);
+	/* No SIGPIPE if the service has closed the connection */
+	n = send(sock, data, len, MSG_NOSIGNAL);
 	LOGHDMILIB("write socket len res:%d %d %d", sock, len, n);
 
 	return n;
 }
 
+/* Write the buffers of iov to service in one call */
+int serversocket_writev(struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg;
+	int n;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	n = sendmsg(serversocket_get(), &msg, MSG_NOSIGNAL);
+	LOGHDMILIB("writev socket iovcnt:%d res:%d", iovcnt, n);
+
+	return n;
+}
+
+/* Write message with descriptors passed by SCM_RIGHTS */
+int serversocket_sendfds(__u8 *buf, int len, int *fds, int nfds)
+{
+	union {
+		struct cmsghdr align;
+		__u8 buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int n;
+
+	if ((nfds < 1) || (nfds > 2))
+		return -1;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+	n = sendmsg(serversocket_get(), &msg, MSG_NOSIGNAL);
+	LOGHDMILIB("sendfds socket len:%d nfds:%d res:%d", len, nfds, n);
+	return n;
+}
+
 int serversocket_close(void)
 {
 	int sock;
 
 	sock = serversocket_get();
+	serversocket_set(-1);
+	if (sock < 0)
+		return 0;
 	return close(sock);
 }
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * Author: Per Persson per.xb.persson@stericsson.com for
+ * ST-Ericsson.
+ *
+ * License terms:
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <unistd.h>     /* Symbolic Constants */
+#include <sys/types.h>  /* Primitive System Data Types */
+#include <linux/types.h>
+#include <errno.h>      /* Errors */
+#include <stdarg.h>
+#include <stdio.h>      /* Input/Output */
+#include <stdlib.h>     /* General Utilities */
+#include <string.h>     /* String handling */
+#include <time.h>
+#ifdef ANDROID
+#include <utils/Log.h>
+#endif
+#include "../include/hdmi_service_api.h"
+#include "../include/hdmi_service_local.h"
+
+/*
+ * Timing of plug handling phases.
+ * For each phase count, min, max and sum are kept for all samples, and the
+ * last STATS_SAMPLES samples are kept to calculate the 99th percentile.
+ * Only used from main thread.
+ */
+struct phase_stats {
+	unsigned int count;
+	unsigned int min;
+	unsigned int max;
+	long long sum;
+	unsigned int samples[STATS_SAMPLES];
+};
+
+static struct phase_stats phase_stats[PHASE_MAX];
+
+static const char * const phase_names[PHASE_MAX] = {
+	"stayalive",
+	"hwformats",
+	"edid0_read",
+	"edid0_parse",
+	"edid1_read",
+	"edid1_parse",
+	"bestformat",
+	"fbcreate",
+	"chres",
+	"plug_total",
+	"verify"
+};
+
+void stats_clear(void)
+{
+	memset(phase_stats, 0, sizeof(phase_stats));
+}
+
+/* Add time from start to now to phase.
+ * Returns now, to be used as start of next phase.
+ */
+long long stats_phase_end(int phase, long long start)
+{
+	struct phase_stats *ps = &phase_stats[phase];
+	long long now = hdmi_time_us();
+	unsigned int time;
+
+	time = (unsigned int)(now - start);
+	if ((ps->count == 0) || (time < ps->min))
+		ps->min = time;
+	if (time > ps->max)
+		ps->max = time;
+	ps->sum += time;
+	ps->samples[ps->count % STATS_SAMPLES] = time;
+	ps->count++;
+	return now;
+}
+
+static int stats_cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Get min, avg, max and 99th percentile of phase in us */
+int stats_phase_get(int phase, unsigned int *count, unsigned int *min,
+		unsigned int *avg, unsigned int *max, unsigned int *p99)
+{
+	struct phase_stats *ps = &phase_stats[phase];
+	unsigned int sorted[STATS_SAMPLES];
+	int nr;
+
+	*count = ps->count;
+	*min = ps->min;
+	*max = ps->max;
+	*avg = 0;
+	*p99 = 0;
+	if (ps->count == 0)
+		return 0;
+
+	*avg = (unsigned int)(ps->sum / ps->count);
+	nr = ps->count < STATS_SAMPLES ? ps->count : STATS_SAMPLES;
+	memcpy(sorted, ps->samples, nr * sizeof(sorted[0]));
+	qsort(sorted, nr, sizeof(sorted[0]), stats_cmp);
+	*p99 = sorted[(nr * 99 - 1) / 100];
+	return 0;
+}
+
+/* Log all phase timings */
+void stats_dump(void)
+{
+	unsigned int count, min, avg, max, p99;
+	int phase;
+
+	for (phase = 0; phase < PHASE_MAX; phase++) {
+		stats_phase_get(phase, &count, &min, &avg, &max, &p99);
+		LOGHDMILIB("%-12s n:%u min:%u avg:%u max:%u p99:%u us",
+				phase_names[phase], count, min, avg, max, p99);
+	}
+}
+
+/* Send phase timings in HDMI_STATSRESP message on client socket */
+int stats_send(__u32 cmd_id)
+{
+	__u8 buf[CMDBUF_OFFSET + 1 + PHASE_MAX * STATS_PHASE_SIZE];
+	unsigned int val[5];
+	__u8 *p;
+	int phase;
+	int len;
+
+	len = 1 + PHASE_MAX * STATS_PHASE_SIZE;
+	val[0] = HDMI_STATSRESP;
+	memcpy(&buf[CMD_OFFSET], &val[0], 4);
+	memcpy(&buf[CMDID_OFFSET], &cmd_id, 4);
+	memcpy(&buf[CMDLEN_OFFSET], &len, 4);
+	buf[CMDBUF_OFFSET] = PHASE_MAX;
+
+	p = &buf[CMDBUF_OFFSET + 1];
+	for (phase = 0; phase < PHASE_MAX; phase++) {
+		stats_phase_get(phase, &val[0], &val[1], &val[2], &val[3],
+								&val[4]);
+		*p++ = phase;
+		memcpy(p, val, sizeof(val));
+		p += sizeof(val);
+	}
+
+	/* Send on socket */
+	return clientsocket_send(buf, CMDBUF_OFFSET + len);
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * Author: Per Persson per.xb.persson@stericsson.com for
+ * ST-Ericsson.
+ *
+ * License terms:
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <unistd.h>     /* Symbolic Constants */
+#include <sys/types.h>  /* Primitive System Data Types */
+#include <linux/types.h>
+#include <errno.h>      /* Errors */
+#include <stdarg.h>
+#include <stdio.h>      /* Input/Output */
+#include <stdlib.h>     /* General Utilities */
+#include <pthread.h>    /* POSIX Threads */
+#include <string.h>     /* String handling */
+#include <fcntl.h>
+#ifdef ANDROID
+#include <utils/Log.h>
+#endif
+#include "../include/hdmi_service_api.h"
+#include "../include/hdmi_service_local.h"
+
+/*
+ * Kernel sysfs files are opened once and kept open. A sysfs attribute is
+ * read again by the driver on each read at offset 0, and each write is
+ * passed to the driver, so pread and pwrite at offset 0 replace the
+ * open/read/write/close sequence. A file is reopened once if the fd turns
+ * out to be stale.
+ */
+struct sysfs_handle {
+	const char *name;
+	int flags;
+	int dispdevice;		/* name is relative to display device dir */
+	int fd;
+	pthread_mutex_t mutex;
+};
+
+#define SYSFS_HANDLE(_name, _flags, _disp) \
+	{_name, _flags, _disp, -1, PTHREAD_MUTEX_INITIALIZER}
+
+static struct sysfs_handle sysfs_handles[SYSFS_FILES_MAX] = {
+	[SYSFS_STOREASTEXT]	= SYSFS_HANDLE(STOREASTEXT_FILE, O_WRONLY, 0),
+	[SYSFS_PLUGDETEN]	= SYSFS_HANDLE(PLUGDETEN_FILE, O_WRONLY, 0),
+	[SYSFS_EVCLR]		= SYSFS_HANDLE(EVENTCLR_FILE, O_WRONLY, 0),
+	[SYSFS_EVWAKEUP]	= SYSFS_HANDLE(EVWAKEUP_FILE, O_WRONLY, 0),
+	[SYSFS_EDIDREAD]	= SYSFS_HANDLE(EDIDREAD_FILE, O_RDWR, 0),
+	[SYSFS_HDCPCHKAESOTP]	= SYSFS_HANDLE(HDCPCHKAESOTP_FILE, O_RDONLY, 0),
+	[SYSFS_HDCPLOADAES]	= SYSFS_HANDLE(HDCPLOADAES_FILE, O_RDWR, 0),
+	[SYSFS_HDCPSTATEGET]	= SYSFS_HANDLE(HDCPSTATEGET_FILE, O_RDONLY, 0),
+	[SYSFS_HDCPAUTH]	= SYSFS_HANDLE(HDCPAUTH_FILE, O_WRONLY, 0),
+	[SYSFS_HDCPEVEN]	= SYSFS_HANDLE(HDCPEVEN_FILE, O_WRONLY, 0),
+	[SYSFS_CECSEND]		= SYSFS_HANDLE(CECSEND_FILE, O_WRONLY, 0),
+	[SYSFS_CECRXEVEN]	= SYSFS_HANDLE(CECRXEVEN_FILE, O_WRONLY, 0),
+	[SYSFS_CECREAD]		= SYSFS_HANDLE(CECREAD_FILE, O_RDONLY, 0),
+	[SYSFS_INFOFRSEND]	= SYSFS_HANDLE(INFOFRSEND_FILE, O_WRONLY, 0),
+	[SYSFS_POWERONOFF]	= SYSFS_HANDLE(POWERONOFF_FILE, O_RDWR, 0),
+	[SYSFS_DISPONOFF]	= SYSFS_HANDLE(DISPONOFF_FILE, O_RDWR, 1),
+	[SYSFS_HDMIFORMAT]	= SYSFS_HANDLE(HDMIFORMAT_FILE, O_WRONLY, 1),
+	[SYSFS_VESACEAFORMATS]	= SYSFS_HANDLE(VESACEAFORMATS_FILE, O_RDONLY, 1),
+	[SYSFS_TIMING]		= SYSFS_HANDLE(TIMING_FILE, O_RDWR, 1),
+	[SYSFS_STAYALIVE]	= SYSFS_HANDLE(STAYALIVE_FILE, O_WRONLY, 1),
+};
+
+/* open and close syscalls avoided by reusing a cached fd */
+static unsigned int sysfs_saved;
+static unsigned int sysfs_reopened;
+
+/* Open file if not open. Handle mutex must be held. */
+static int sysfs_handle_open(struct sysfs_handle *handle)
+{
+	if (handle->fd >= 0) {
+		__atomic_add_fetch(&sysfs_saved, 2, __ATOMIC_RELAXED);
+		return handle->fd;
+	}
+
+	if (handle->dispdevice)
+		handle->fd = dispdevice_file_open((char *)handle->name,
+							handle->flags);
+	else
+		handle->fd = open(handle->name, handle->flags);
+	if (handle->fd < 0)
+		LOGHDMILIB("***** Failed to open %s *****", handle->name);
+	return handle->fd;
+}
+
+static void sysfs_handle_close(struct sysfs_handle *handle)
+{
+	if (handle->fd >= 0) {
+		close(handle->fd);
+		handle->fd = -1;
+	}
+}
+
+/* Errors meaning that the fd no longer refers to a usable file */
+static int sysfs_stale(int err)
+{
+	return (err == EBADF) || (err == ENODEV) || (err == ENOENT) ||
+			(err == ENXIO) || (err == ESTALE);
+}
+
+/* Open file to check that it exists. Returns fd or negative value. */
+int sysfs_open(enum sysfs_file file)
+{
+	struct sysfs_handle *handle = &sysfs_handles[file];
+	int fd;
+
+	pthread_mutex_lock(&handle->mutex);
+	fd = sysfs_handle_open(handle);
+	pthread_mutex_unlock(&handle->mutex);
+	return fd;
+}
+
+/* Read file from offset 0. Returns number of bytes read or -1. */
+int sysfs_read(enum sysfs_file file, void *buf, int size)
+{
+	struct sysfs_handle *handle = &sysfs_handles[file];
+	int retry = 1;
+	int res = -1;
+
+	pthread_mutex_lock(&handle->mutex);
+	while (sysfs_handle_open(handle) >= 0) {
+		res = pread(handle->fd, buf, size, 0);
+		if ((res >= 0) || !retry || !sysfs_stale(errno))
+			break;
+		sysfs_handle_close(handle);
+		__atomic_add_fetch(&sysfs_reopened, 1, __ATOMIC_RELAXED);
+		retry = 0;
+	}
+	pthread_mutex_unlock(&handle->mutex);
+	return res;
+}
+
+/* Write file at offset 0. Returns number of bytes written or -1. */
+int sysfs_write(enum sysfs_file file, const void *buf, int size)
+{
+	struct sysfs_handle *handle = &sysfs_handles[file];
+	int retry = 1;
+	int res = -1;
+
+	pthread_mutex_lock(&handle->mutex);
+	while (sysfs_handle_open(handle) >= 0) {
+		res = pwrite(handle->fd, buf, size, 0);
+		if ((res >= 0) || !retry || !sysfs_stale(errno))
+			break;
+		sysfs_handle_close(handle);
+		__atomic_add_fetch(&sysfs_reopened, 1, __ATOMIC_RELAXED);
+		retry = 0;
+	}
+	pthread_mutex_unlock(&handle->mutex);
+	return res;
+}
+
+/* Close files in display device dir, e.g. when the device has changed */
+void sysfs_dispdevice_close(void)
+{
+	int file;
+
+	for (file = 0; file < SYSFS_FILES_MAX; file++) {
+		if (!sysfs_handles[file].dispdevice)
+			continue;
+		pthread_mutex_lock(&sysfs_handles[file].mutex);
+		sysfs_handle_close(&sysfs_handles[file]);
+		pthread_mutex_unlock(&sysfs_handles[file].mutex);
+	}
+}
+
+void sysfs_close_all(void)
+{
+	int file;
+
+	for (file = 0; file < SYSFS_FILES_MAX; file++) {
+		pthread_mutex_lock(&sysfs_handles[file].mutex);
+		sysfs_handle_close(&sysfs_handles[file]);
+		pthread_mutex_unlock(&sysfs_handles[file].mutex);
+	}
+	LOGHDMILIB("sysfs syscalls saved:%u reopened:%u", sysfs_saved,
+							sysfs_reopened);
+}
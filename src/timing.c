@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * Author: Per Persson per.xb.persson@stericsson.com for
+ * ST-Ericsson.
+ *
+ * License terms:
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <unistd.h>     /* Symbolic Constants */
+#include <sys/types.h>  /* Primitive System Data Types */
+#include <linux/types.h>
+#include <stdio.h>      /* Input/Output */
+#include <stdlib.h>     /* General Utilities */
+#include <string.h>     /* String handling */
+#ifdef ANDROID
+#include <utils/Log.h>
+#endif
+#include "../include/hdmi_service_api.h"
+#include "../include/hdmi_service_local.h"
+
+/* Pixel clock period in ps from frequency in kHz */
+#define PICOS(khz)	(1000000000UL / (khz))
+
+#define TIMING(x, y, r, khz, hfp, hs, hbp, vfp, vs, vbp, flags) \
+	{x, y, PICOS(khz), hfp, hs, hbp, vfp, vs, vbp, r, flags}
+
+#define I	TIMING_INTERLACED
+#define RB	TIMING_RB
+#define A4	TIMING_AR_4_3
+#define A16	TIMING_AR_16_9
+#define A64	TIMING_AR_64_27
+
+/* CEA-861 video formats, indexed by VIC */
+static const struct video_timing cea_timings[VESACEA_NR_MAX] = {
+	[1] = TIMING(640, 480, 60, 25175, 16, 96, 48, 10, 2, 33, A4),
+	[2] = TIMING(720, 480, 60, 27000, 16, 62, 60, 9, 6, 30, A4),
+	[3] = TIMING(720, 480, 60, 27000, 16, 62, 60, 9, 6, 30, A16),
+	[4] = TIMING(1280, 720, 60, 74250, 110, 40, 220, 5, 5, 20, A16),
+	[5] = TIMING(1920, 1080, 60, 74250, 88, 44, 148, 2, 5, 15, I | A16),
+	[6] = TIMING(1440, 480, 60, 27000, 38, 124, 114, 4, 3, 15, I | A4),
+	[7] = TIMING(1440, 480, 60, 27000, 38, 124, 114, 4, 3, 15, I | A16),
+	[8] = TIMING(1440, 240, 60, 27000, 38, 124, 114, 4, 3, 15, A4),
+	[9] = TIMING(1440, 240, 60, 27000, 38, 124, 114, 4, 3, 15, A16),
+	[10] = TIMING(2880, 480, 60, 54000, 76, 248, 228, 4, 3, 15, I | A4),
+	[11] = TIMING(2880, 480, 60, 54000, 76, 248, 228, 4, 3, 15, I | A16),
+	[12] = TIMING(2880, 240, 60, 54000, 76, 248, 228, 4, 3, 15, A4),
+	[13] = TIMING(2880, 240, 60, 54000, 76, 248, 228, 4, 3, 15, A16),
+	[14] = TIMING(1440, 480, 60, 54000, 32, 124, 120, 9, 6, 30, A4),
+	[15] = TIMING(1440, 480, 60, 54000, 32, 124, 120, 9, 6, 30, A16),
+	[16] = TIMING(1920, 1080, 60, 148500, 88, 44, 148, 4, 5, 36, A16),
+	[17] = TIMING(720, 576, 50, 27000, 12, 64, 68, 5, 5, 39, A4),
+	[18] = TIMING(720, 576, 50, 27000, 12, 64, 68, 5, 5, 39, A16),
+	[19] = TIMING(1280, 720, 50, 74250, 440, 40, 220, 5, 5, 20, A16),
+	[20] = TIMING(1920, 1080, 50, 74250, 528, 44, 148, 2, 5, 15, I | A16),
+	[21] = TIMING(1440, 576, 50, 27000, 24, 126, 138, 2, 3, 19, I | A4),
+	[22] = TIMING(1440, 576, 50, 27000, 24, 126, 138, 2, 3, 19, I | A16),
+	[23] = TIMING(1440, 288, 50, 27000, 24, 126, 138, 2, 3, 19, A4),
+	[24] = TIMING(1440, 288, 50, 27000, 24, 126, 138, 2, 3, 19, A16),
+	[25] = TIMING(2880, 576, 50, 54000, 48, 252, 276, 2, 3, 19, I | A4),
+	[26] = TIMING(2880, 576, 50, 54000, 48, 252, 276, 2, 3, 19, I | A16),
+	[27] = TIMING(2880, 288, 50, 54000, 48, 252, 276, 2, 3, 19, A4),
+	[28] = TIMING(2880, 288, 50, 54000, 48, 252, 276, 2, 3, 19, A16),
+	[29] = TIMING(1440, 576, 50, 54000, 24, 128, 136, 5, 5, 39, A4),
+	[30] = TIMING(1440, 576, 50, 54000, 24, 128, 136, 5, 5, 39, A16),
+	[31] = TIMING(1920, 1080, 50, 148500, 528, 44, 148, 4, 5, 36, A16),
+	[32] = TIMING(1920, 1080, 24, 74250, 638, 44, 148, 4, 5, 36, A16),
+	[33] = TIMING(1920, 1080, 25, 74250, 528, 44, 148, 4, 5, 36, A16),
+	[34] = TIMING(1920, 1080, 30, 74250, 88, 44, 148, 4, 5, 36, A16),
+	[35] = TIMING(2880, 480, 60, 108000, 64, 248, 240, 9, 6, 30, A4),
+	[36] = TIMING(2880, 480, 60, 108000, 64, 248, 240, 9, 6, 30, A16),
+	[37] = TIMING(2880, 576, 50, 108000, 48, 256, 272, 5, 5, 39, A4),
+	[38] = TIMING(2880, 576, 50, 108000, 48, 256, 272, 5, 5, 39, A16),
+	[39] = TIMING(1920, 1080, 50, 72000, 32, 168, 184, 23, 5, 57, I | A16),
+	[40] = TIMING(1920, 1080, 100, 148500, 528, 44, 148, 2, 5, 15, I | A16),
+	[41] = TIMING(1280, 720, 100, 148500, 440, 40, 220, 5, 5, 20, A16),
+	[42] = TIMING(720, 576, 100, 54000, 12, 64, 68, 5, 5, 39, A4),
+	[43] = TIMING(720, 576, 100, 54000, 12, 64, 68, 5, 5, 39, A16),
+	[44] = TIMING(1440, 576, 100, 54000, 24, 126, 138, 2, 3, 19, I | A4),
+	[45] = TIMING(1440, 576, 100, 54000, 24, 126, 138, 2, 3, 19, I | A16),
+	[46] = TIMING(1920, 1080, 120, 148500, 88, 44, 148, 2, 5, 15, I | A16),
+	[47] = TIMING(1280, 720, 120, 148500, 110, 40, 220, 5, 5, 20, A16),
+	[48] = TIMING(720, 480, 120, 54000, 16, 62, 60, 9, 6, 30, A4),
+	[49] = TIMING(720, 480, 120, 54000, 16, 62, 60, 9, 6, 30, A16),
+	[50] = TIMING(1440, 480, 120, 54000, 38, 124, 114, 4, 3, 15, I | A4),
+	[51] = TIMING(1440, 480, 120, 54000, 38, 124, 114, 4, 3, 15, I | A16),
+	[52] = TIMING(720, 576, 200, 108000, 12, 64, 68, 5, 5, 39, A4),
+	[53] = TIMING(720, 576, 200, 108000, 12, 64, 68, 5, 5, 39, A16),
+	[54] = TIMING(1440, 576, 200, 108000, 24, 126, 138, 2, 3, 19, I | A4),
+	[55] = TIMING(1440, 576, 200, 108000, 24, 126, 138, 2, 3, 19, I | A16),
+	[56] = TIMING(720, 480, 240, 108000, 16, 62, 60, 9, 6, 30, A4),
+	[57] = TIMING(720, 480, 240, 108000, 16, 62, 60, 9, 6, 30, A16),
+	[58] = TIMING(1440, 480, 240, 108000, 38, 124, 114, 4, 3, 15, I | A4),
+	[59] = TIMING(1440, 480, 240, 108000, 38, 124, 114, 4, 3, 15, I | A16),
+	[60] = TIMING(1280, 720, 24, 59400, 1760, 40, 220, 5, 5, 20, A16),
+	[61] = TIMING(1280, 720, 25, 74250, 2420, 40, 220, 5, 5, 20, A16),
+	[62] = TIMING(1280, 720, 30, 74250, 1760, 40, 220, 5, 5, 20, A16),
+	[63] = TIMING(1920, 1080, 120, 297000, 88, 44, 148, 4, 5, 36, A16),
+	[64] = TIMING(1920, 1080, 100, 297000, 528, 44, 148, 4, 5, 36, A16),
+	[93] = TIMING(3840, 2160, 24, 297000, 1276, 88, 296, 8, 10, 72, A16),
+	[94] = TIMING(3840, 2160, 25, 297000, 1056, 88, 296, 8, 10, 72, A16),
+	[95] = TIMING(3840, 2160, 30, 297000, 176, 88, 296, 8, 10, 72, A16),
+	[96] = TIMING(3840, 2160, 50, 594000, 1056, 88, 296, 8, 10, 72, A16),
+	[97] = TIMING(3840, 2160, 60, 594000, 176, 88, 296, 8, 10, 72, A16),
+	[98] = TIMING(4096, 2160, 24, 297000, 1020, 88, 296, 8, 10, 72, 0),
+	[99] = TIMING(4096, 2160, 25, 297000, 968, 88, 128, 8, 10, 72, 0),
+	[100] = TIMING(4096, 2160, 30, 297000, 88, 88, 128, 8, 10, 72, 0),
+	[101] = TIMING(4096, 2160, 50, 594000, 968, 88, 128, 8, 10, 72, 0),
+	[102] = TIMING(4096, 2160, 60, 594000, 88, 88, 128, 8, 10, 72, 0),
+	[103] = TIMING(3840, 2160, 24, 297000, 1276, 88, 296, 8, 10, 72, A64),
+	[104] = TIMING(3840, 2160, 25, 297000, 1056, 88, 296, 8, 10, 72, A64),
+	[105] = TIMING(3840, 2160, 30, 297000, 176, 88, 296, 8, 10, 72, A64),
+	[106] = TIMING(3840, 2160, 50, 594000, 1056, 88, 296, 8, 10, 72, A64),
+	[107] = TIMING(3840, 2160, 60, 594000, 176, 88, 296, 8, 10, 72, A64),
+};
+
+/* VESA DMT video formats, indexed by DMT ID */
+static const struct video_timing dmt_timings[VESACEA_NR_MAX] = {
+	[0x01] = TIMING(640, 350, 85, 31500, 32, 64, 96, 32, 3, 60, 0),
+	[0x02] = TIMING(640, 400, 85, 31500, 32, 64, 96, 1, 3, 41, 0),
+	[0x03] = TIMING(720, 400, 85, 35500, 36, 72, 108, 1, 3, 42, 0),
+	[0x04] = TIMING(640, 480, 60, 25175, 16, 96, 48, 10, 2, 33, 0),
+	[0x05] = TIMING(640, 480, 72, 31500, 24, 40, 128, 9, 3, 28, 0),
+	[0x06] = TIMING(640, 480, 75, 31500, 16, 64, 120, 1, 3, 16, 0),
+	[0x07] = TIMING(640, 480, 85, 36000, 56, 56, 80, 1, 3, 25, 0),
+	[0x08] = TIMING(800, 600, 56, 36000, 24, 72, 128, 1, 2, 22, 0),
+	[0x09] = TIMING(800, 600, 60, 40000, 40, 128, 88, 1, 4, 23, 0),
+	[0x0A] = TIMING(800, 600, 72, 50000, 56, 120, 64, 37, 6, 23, 0),
+	[0x0B] = TIMING(800, 600, 75, 49500, 16, 80, 160, 1, 3, 21, 0),
+	[0x0C] = TIMING(800, 600, 85, 56250, 32, 64, 152, 1, 3, 27, 0),
+	[0x0D] = TIMING(800, 600, 120, 73250, 48, 32, 80, 3, 4, 29, RB),
+	[0x0E] = TIMING(848, 480, 60, 33750, 16, 112, 112, 6, 8, 23, 0),
+	[0x0F] = TIMING(1024, 768, 43, 44900, 8, 176, 56, 0, 4, 20, I),
+	[0x10] = TIMING(1024, 768, 60, 65000, 24, 136, 160, 3, 6, 29, 0),
+	[0x11] = TIMING(1024, 768, 70, 75000, 24, 136, 144, 3, 6, 29, 0),
+	[0x12] = TIMING(1024, 768, 75, 78750, 16, 96, 176, 1, 3, 28, 0),
+	[0x13] = TIMING(1024, 768, 85, 94500, 48, 96, 208, 1, 3, 36, 0),
+	[0x14] = TIMING(1024, 768, 120, 115500, 48, 32, 80, 3, 4, 38, RB),
+	[0x15] = TIMING(1152, 864, 75, 108000, 64, 128, 256, 1, 3, 32, 0),
+	[0x16] = TIMING(1280, 768, 60, 68250, 48, 32, 80, 3, 7, 12, RB),
+	[0x17] = TIMING(1280, 768, 60, 79500, 64, 128, 192, 3, 7, 20, 0),
+	[0x18] = TIMING(1280, 768, 75, 102250, 80, 128, 208, 3, 7, 27, 0),
+	[0x19] = TIMING(1280, 768, 85, 117500, 80, 136, 216, 3, 7, 31, 0),
+	[0x1A] = TIMING(1280, 768, 120, 140250, 48, 32, 80, 3, 7, 35, RB),
+	[0x1B] = TIMING(1280, 800, 60, 71000, 48, 32, 80, 3, 6, 14, RB),
+	[0x1C] = TIMING(1280, 800, 60, 83500, 72, 128, 200, 3, 6, 22, 0),
+	[0x1D] = TIMING(1280, 800, 75, 106500, 80, 128, 208, 3, 6, 29, 0),
+	[0x1E] = TIMING(1280, 800, 85, 122500, 80, 136, 216, 3, 6, 34, 0),
+	[0x1F] = TIMING(1280, 800, 120, 146250, 48, 32, 80, 3, 6, 38, RB),
+	[0x20] = TIMING(1280, 960, 60, 108000, 96, 112, 312, 1, 3, 36, 0),
+	[0x21] = TIMING(1280, 960, 85, 148500, 64, 160, 224, 1, 3, 47, 0),
+	[0x22] = TIMING(1280, 960, 120, 175500, 48, 32, 80, 3, 4, 50, RB),
+	[0x23] = TIMING(1280, 1024, 60, 108000, 48, 112, 248, 1, 3, 38, 0),
+	[0x24] = TIMING(1280, 1024, 75, 135000, 16, 144, 248, 1, 3, 38, 0),
+	[0x25] = TIMING(1280, 1024, 85, 157500, 64, 160, 224, 1, 3, 44, 0),
+	[0x26] = TIMING(1280, 1024, 120, 187250, 48, 32, 80, 3, 7, 50, RB),
+	[0x27] = TIMING(1360, 768, 60, 85500, 64, 112, 256, 3, 6, 18, 0),
+	[0x28] = TIMING(1360, 768, 120, 148250, 48, 32, 80, 3, 5, 37, RB),
+	[0x29] = TIMING(1400, 1050, 60, 101000, 48, 32, 80, 3, 4, 23, RB),
+	[0x2A] = TIMING(1400, 1050, 60, 121750, 88, 144, 232, 3, 4, 32, 0),
+	[0x2B] = TIMING(1400, 1050, 75, 156000, 104, 144, 248, 3, 4, 42, 0),
+	[0x2C] = TIMING(1400, 1050, 85, 179500, 104, 152, 256, 3, 4, 48, 0),
+	[0x2D] = TIMING(1400, 1050, 120, 208000, 48, 32, 80, 3, 4, 55, RB),
+	[0x2E] = TIMING(1440, 900, 60, 88750, 48, 32, 80, 3, 6, 17, RB),
+	[0x2F] = TIMING(1440, 900, 60, 106500, 80, 152, 232, 3, 6, 25, 0),
+	[0x30] = TIMING(1440, 900, 75, 136750, 96, 152, 248, 3, 6, 33, 0),
+	[0x31] = TIMING(1440, 900, 85, 157000, 104, 152, 256, 3, 6, 39, 0),
+	[0x32] = TIMING(1440, 900, 120, 182750, 48, 32, 80, 3, 6, 44, RB),
+	[0x33] = TIMING(1600, 1200, 60, 162000, 64, 192, 304, 1, 3, 46, 0),
+	[0x34] = TIMING(1600, 1200, 65, 175500, 64, 192, 304, 1, 3, 46, 0),
+	[0x35] = TIMING(1600, 1200, 70, 189000, 64, 192, 304, 1, 3, 46, 0),
+	[0x36] = TIMING(1600, 1200, 75, 202500, 64, 192, 304, 1, 3, 46, 0),
+	[0x37] = TIMING(1600, 1200, 85, 229500, 64, 192, 304, 1, 3, 46, 0),
+	[0x38] = TIMING(1600, 1200, 120, 268250, 48, 32, 80, 3, 4, 64, RB),
+	[0x39] = TIMING(1680, 1050, 60, 119000, 48, 32, 80, 3, 6, 21, RB),
+	[0x3A] = TIMING(1680, 1050, 60, 146250, 104, 176, 280, 3, 6, 30, 0),
+	[0x3B] = TIMING(1680, 1050, 75, 187000, 120, 176, 296, 3, 6, 40, 0),
+	[0x3C] = TIMING(1680, 1050, 85, 214750, 128, 176, 304, 3, 6, 46, 0),
+	[0x3D] = TIMING(1680, 1050, 120, 245500, 48, 32, 80, 3, 6, 53, RB),
+	[0x3E] = TIMING(1792, 1344, 60, 204750, 128, 200, 328, 1, 3, 46, 0),
+	[0x3F] = TIMING(1792, 1344, 75, 261000, 96, 216, 352, 1, 3, 69, 0),
+	[0x40] = TIMING(1792, 1344, 120, 333250, 48, 32, 80, 3, 4, 72, RB),
+	[0x41] = TIMING(1856, 1392, 60, 218250, 96, 224, 352, 1, 3, 43, 0),
+	[0x42] = TIMING(1856, 1392, 75, 288000, 128, 224, 352, 1, 3, 104, 0),
+	[0x43] = TIMING(1856, 1392, 120, 356500, 48, 32, 80, 3, 4, 75, RB),
+	[0x44] = TIMING(1920, 1200, 60, 154000, 48, 32, 80, 3, 6, 26, RB),
+	[0x45] = TIMING(1920, 1200, 60, 193250, 136, 200, 336, 3, 6, 36, 0),
+	[0x46] = TIMING(1920, 1200, 75, 245250, 136, 208, 344, 3, 6, 46, 0),
+	[0x47] = TIMING(1920, 1200, 85, 281250, 144, 208, 352, 3, 6, 53, 0),
+	[0x48] = TIMING(1920, 1200, 120, 317000, 48, 32, 80, 3, 6, 62, RB),
+	[0x49] = TIMING(1920, 1440, 60, 234000, 128, 208, 344, 1, 3, 56, 0),
+	[0x4A] = TIMING(1920, 1440, 75, 297000, 144, 224, 352, 1, 3, 56, 0),
+	[0x4B] = TIMING(1920, 1440, 120, 380500, 48, 32, 80, 3, 4, 78, RB),
+	[0x4C] = TIMING(2560, 1600, 60, 268500, 48, 32, 80, 3, 6, 37, RB),
+	[0x4D] = TIMING(2560, 1600, 60, 348500, 192, 280, 472, 3, 6, 49, 0),
+	[0x4E] = TIMING(2560, 1600, 75, 443250, 208, 280, 488, 3, 6, 63, 0),
+	[0x4F] = TIMING(2560, 1600, 85, 505250, 208, 280, 488, 3, 6, 73, 0),
+	[0x50] = TIMING(2560, 1600, 120, 552750, 48, 32, 80, 3, 6, 85, RB),
+	[0x51] = TIMING(1366, 768, 60, 85500, 70, 143, 213, 3, 3, 24, 0),
+	[0x52] = TIMING(1920, 1080, 60, 148500, 88, 44, 148, 4, 5, 36, 0),
+	[0x53] = TIMING(1600, 900, 60, 108000, 24, 80, 96, 1, 3, 96, RB),
+	[0x54] = TIMING(2048, 1152, 60, 162000, 26, 80, 96, 1, 3, 44, RB),
+	[0x55] = TIMING(1280, 720, 60, 74250, 110, 40, 220, 5, 5, 20, 0),
+	[0x56] = TIMING(1366, 768, 60, 72000, 14, 56, 64, 1, 3, 28, RB),
+};
+
+#undef I
+#undef RB
+#undef A4
+#undef A16
+#undef A64
+
+/*
+ * DMT IDs hashed by (xres, yres, refresh) for Standard Timing lookup.
+ * Built on first use. Interlaced formats are not hashed, and reduced
+ * blanking formats only when no normal blanking format has the same key,
+ * as Standard Timings do not tell them apart.
+ */
+#define DMT_HASH_SIZE	128	/* Power of two, > nr of DMT IDs */
+
+static __u8 dmt_hash[DMT_HASH_SIZE];
+static int dmt_hash_built;
+
+static unsigned int dmt_hash_key(int xres, int yres, int refresh)
+{
+	return ((xres >> 3) * 31 + yres * 7 + refresh) & (DMT_HASH_SIZE - 1);
+}
+
+static void dmt_hash_build(void)
+{
+	const struct video_timing *t;
+	unsigned int key;
+	int pass;
+	int nr;
+
+	for (pass = 0; pass <= 1; pass++)
+		for (nr = 1; nr < VESACEA_NR_MAX; nr++) {
+			t = &dmt_timings[nr];
+			if ((t->xres == 0) || (t->flags & TIMING_INTERLACED))
+				continue;
+			if (!!(t->flags & TIMING_RB) != pass)
+				continue;
+			if (pass && (timing_dmt_find(t->xres, t->yres,
+							t->refresh) > 0))
+				continue;
+
+			key = dmt_hash_key(t->xres, t->yres, t->refresh);
+			while (dmt_hash[key])
+				key = (key + 1) & (DMT_HASH_SIZE - 1);
+			dmt_hash[key] = nr;
+		}
+}
+
+/* Returns the DMT ID of xres x yres at refresh Hz, or -1 if none */
+int timing_dmt_find(int xres, int yres, int refresh)
+{
+	const struct video_timing *t;
+	unsigned int key;
+
+	if (!dmt_hash_built) {
+		dmt_hash_built = 1;
+		dmt_hash_build();
+	}
+
+	key = dmt_hash_key(xres, yres, refresh);
+	while (dmt_hash[key]) {
+		t = &dmt_timings[dmt_hash[key]];
+		if ((t->xres == xres) && (t->yres == yres) &&
+						(t->refresh == refresh))
+			return dmt_hash[key];
+		key = (key + 1) & (DMT_HASH_SIZE - 1);
+	}
+	return -1;
+}
+
+/* Returns the timing of CEA VIC or DMT ID nr, or NULL if unknown */
+const struct video_timing *timing_get(__u8 cea, __u8 nr)
+{
+	const struct video_timing *t;
+
+	if (nr >= VESACEA_NR_MAX)
+		return NULL;
+
+	t = cea ? &cea_timings[nr] : &dmt_timings[nr];
+	if (t->xres == 0)
+		return NULL;
+	return t;
+}
+
+static int timing_equal(const struct video_timing *a,
+					const struct video_timing *b)
+{
+	int pixdiff = (int)a->pixclock - (int)b->pixclock;
+
+	/* Pixel clocks of 1000/1001 rate variants differ by 0.1% */
+	if (abs(pixdiff) > (int)b->pixclock / 200)
+		return 0;
+	if ((a->flags ^ b->flags) & TIMING_INTERLACED)
+		return 0;
+	if ((a->flags & TIMING_AR_MASK) && (b->flags & TIMING_AR_MASK) &&
+			((a->flags ^ b->flags) & TIMING_AR_MASK))
+		return 0;
+	return (a->xres == b->xres) && (a->yres == b->yres) &&
+		(a->hfp == b->hfp) && (a->hsync == b->hsync) &&
+		(a->hbp == b->hbp) && (a->vfp == b->vfp) &&
+		(a->vsync == b->vsync) && (a->vbp == b->vbp);
+}
+
+/*
+ * Add the CEA and DMT formats with timing t to set. The aspect ratio of t
+ * is only compared if set. Returns the number of formats added.
+ */
+int timing_match(const struct video_timing *t, struct vesacea_set *set)
+{
+	int cnt = 0;
+	int nr;
+
+	for (nr = 1; nr < VESACEA_NR_MAX; nr++) {
+		if (cea_timings[nr].xres &&
+				timing_equal(t, &cea_timings[nr])) {
+			vesacea_set_add(set, 1, nr);
+			cnt++;
+		}
+		if (dmt_timings[nr].xres &&
+				timing_equal(t, &dmt_timings[nr])) {
+			vesacea_set_add(set, 0, nr);
+			cnt++;
+		}
+	}
+	return cnt;
+}